@@ -35,71 +35,73 @@ using std::string;
 using std::to_string;
 
 
-Move::Move() {
+Position::Position() {
+    for (int color = 0; color < 2; color++) {
+        for (int type = 0; type < 6; type++) bb[color][type] = Bitboard::EMPTY;
+        occupancy[color] = Bitboard::EMPTY;
+    }
+    for (int sq = 0; sq < 64; sq++) board[sq] = Bitboard::NO_PIECE;
+
+    hash = 0;
+    pawn_hash = 0;
+    turn = true;
+    castling = 0;
+    ep = false;
+    ep_square = 0;
+    move_cnt = 0;
+    draw50 = 0;
+}
+
+bool Position::operator==(const Position &rhs) const {
+    for (int color = 0; color < 2; color++) {
+        for (int type = 0; type < 6; type++) {
+            if (bb[color][type] != rhs.bb[color][type]) return false;
+        }
+        if (occupancy[color] != rhs.occupancy[color]) return false;
+    }
+    for (int sq = 0; sq < 64; sq++) {
+        if (board[sq] != rhs.board[sq]) return false;
+    }
+    return hash == rhs.hash && pawn_hash == rhs.pawn_hash && turn == rhs.turn && castling == rhs.castling
+        && ep == rhs.ep && ep_square == rhs.ep_square && move_cnt == rhs.move_cnt && draw50 == rhs.draw50;
 }
 
-Move::Move(const char _from, const char _to, const bool _is_promo, const char _promo) {
-    from = _from;
-    to = _to;
-    is_promo = _is_promo;
-    promo = _promo;
+
+
+MoveList::MoveList() {
+    count = 0;
 }
 
-bool Move::operator==(const Move &rhs) const {
-    return from == rhs.from && to == rhs.to && is_promo == rhs.is_promo && promo == rhs.promo;
+Move* MoveList::begin() {
+    return moves;
 }
 
+Move* MoveList::end() {
+    return moves + count;
+}
 
-Position::Position() {
-    wp = Bitboard::EMPTY;
-    wn = Bitboard::EMPTY;
-    wb = Bitboard::EMPTY;
-    wr = Bitboard::EMPTY;
-    wq = Bitboard::EMPTY;
-    wk = Bitboard::EMPTY;
-    bp = Bitboard::EMPTY;
-    bn = Bitboard::EMPTY;
-    bb = Bitboard::EMPTY;
-    br = Bitboard::EMPTY;
-    bq = Bitboard::EMPTY;
-    bk = Bitboard::EMPTY;
+const Move* MoveList::begin() const {
+    return moves;
+}
 
-    turn = true;
-    castling = 0;
-    ep = false;
-    ep_square = 0;
-    move_cnt = 0;
+const Move* MoveList::end() const {
+    return moves + count;
 }
 
-Position::Position(const U64 _wp, const U64 _wn, const U64 _wb, const U64 _wr, const U64 _wq, const U64 _wk,
-        const U64 _bp, const U64 _bn, const U64 _bb, const U64 _br, const U64 _bq, const U64 _bk,
-        const bool _turn, const char _castling, const bool _ep, const char _ep_square) {
-    wp = _wp;
-    wn = _wn;
-    wb = _wb;
-    wr = _wr;
-    wq = _wq;
-    wk = _wk;
-    bp = _bp;
-    bn = _bn;
-    bb = _bb;
-    br = _br;
-    bq = _bq;
-    bk = _bk;
-
-    turn = _turn;
-    castling = _castling;
-    ep = _ep;
-    ep_square = _ep_square;
-    move_cnt = 0;
-    draw50 = 0;
+Move& MoveList::operator[](const int& i) {
+    return moves[i];
 }
 
-bool Position::operator==(const Position &rhs) const {
-    return  wp == rhs.wp && wn == rhs.wn && wb == rhs.wb && wr == rhs.wr && wq == rhs.wq && wk == rhs.wk
-        && bp == rhs.bp && bn == rhs.bn && bb == rhs.bb && br == rhs.br && bq == rhs.bq && bk == rhs.bk
-        && turn == rhs.turn && castling == rhs.castling && ep == rhs.ep
-        && ep_square == rhs.ep_square && move_cnt == rhs.move_cnt && draw50 == rhs.draw50;
+const Move& MoveList::operator[](const int& i) const {
+    return moves[i];
+}
+
+int MoveList::size() const {
+    return count;
+}
+
+bool MoveList::empty() const {
+    return count == 0;
 }
 
 
@@ -124,150 +126,125 @@ Location::Location(const UCH _loc) {
 
 
 namespace Bitboard {
-    constexpr char POPCNT_TBL[256] = {
-        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-        1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-        1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-        2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-        1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-        2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-        2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-        3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8,
-    };
-
-    bool bit(const U64& board, const char& pos) {
-        return ((1ULL << pos) & board) != 0;
-    }
-
-    bool bit(const UCH& board, const char& pos) {
-        return ((1ULL << pos) & board) != 0;
-    }
-
-    char popcnt(const U64& num) {
-        return (
-            POPCNT_TBL[ num      & 255ULL] +
-            POPCNT_TBL[(num>>8)  & 255ULL] +
-            POPCNT_TBL[(num>>16) & 255ULL] +
-            POPCNT_TBL[(num>>24) & 255ULL] +
-            POPCNT_TBL[(num>>32) & 255ULL] +
-            POPCNT_TBL[(num>>40) & 255ULL] +
-            POPCNT_TBL[(num>>48) & 255ULL] +
-            POPCNT_TBL[(num>>56) & 255ULL]
-        );
-    }
-
-    void set_bit(U64& board, const char& pos) {
-        board |= (1ULL << pos);
+    Magic ROOK_MAGICS[64];
+    Magic BISHOP_MAGICS[64];
+    U64 ROOK_TABLE[102400];
+    U64 BISHOP_TABLE[5248];
+    U64 BETWEEN[64][64];
+
+    // Seeds (reset for every square) that find all magics quickly.
+    constexpr U64 MAGIC_SEEDS[8] = {728, 10316, 55013, 32803, 12281, 15100, 16645, 255};
+    U64 magic_seed;
+
+    U64 magic_rand() {
+        // Xorshift, kept separate from Random so magics are the same on every run.
+        magic_seed ^= magic_seed >> 12;
+        magic_seed ^= magic_seed << 25;
+        magic_seed ^= magic_seed >> 27;
+        return magic_seed * 2685821657736338717ULL;
     }
 
-    void unset_bit(U64& board, const char& pos) {
-        board &= ~(1ULL << pos);
-    }
-
-    void set_bit(UCH& board, const char& pos) {
-        board |= (1ULL << pos);
-    }
-
-    void unset_bit(UCH& board, const char& pos) {
-        board &= ~(1ULL << pos);
-    }
-
-    bool in_board(const char& x, const char& y) {
-        return (0 <= x && x < 8 && 0 <= y && y < 8);
+    U64 ray_attacks(const char& sq, const U64& occupied, const bool& rook) {
+        /*
+        Slow ray walk, only used to build the attack tables.
+        sq: Square of slider.
+        occupied: Blocking pieces.
+        rook: true for rook directions, false for bishop directions.
+        */
+        U64 board = EMPTY;
+        for (const auto& dir: (rook ? DIR_R : DIR_B)) {
+            char cx = sq&7, cy = sq>>3;
+            while (true) {
+                cx += dir[0];
+                cy += dir[1];
+                if (!in_board(cx, cy)) break;
+                const char loc = (cy<<3) + cx;
+                set_bit(board, loc);
+                if (bit(occupied, loc)) break;
+            }
+        }
+        return board;
     }
 
-    char first_bit_char(const U64& board) {
-        switch (board) {
-            case 1ULL:                   return 0;
-            case 2ULL:                   return 1;
-            case 4ULL:                   return 2;
-            case 8ULL:                   return 3;
-            case 16ULL:                  return 4;
-            case 32ULL:                  return 5;
-            case 64ULL:                  return 6;
-            case 128ULL:                 return 7;
-            case 256ULL:                 return 8;
-            case 512ULL:                 return 9;
-            case 1024ULL:                return 10;
-            case 2048ULL:                return 11;
-            case 4096ULL:                return 12;
-            case 8192ULL:                return 13;
-            case 16384ULL:               return 14;
-            case 32768ULL:               return 15;
-            case 65536ULL:               return 16;
-            case 131072ULL:              return 17;
-            case 262144ULL:              return 18;
-            case 524288ULL:              return 19;
-            case 1048576ULL:             return 20;
-            case 2097152ULL:             return 21;
-            case 4194304ULL:             return 22;
-            case 8388608ULL:             return 23;
-            case 16777216ULL:            return 24;
-            case 33554432ULL:            return 25;
-            case 67108864ULL:            return 26;
-            case 134217728ULL:           return 27;
-            case 268435456ULL:           return 28;
-            case 536870912ULL:           return 29;
-            case 1073741824ULL:          return 30;
-            case 2147483648ULL:          return 31;
-            case 4294967296ULL:          return 32;
-            case 8589934592ULL:          return 33;
-            case 17179869184ULL:         return 34;
-            case 34359738368ULL:         return 35;
-            case 68719476736ULL:         return 36;
-            case 137438953472ULL:        return 37;
-            case 274877906944ULL:        return 38;
-            case 549755813888ULL:        return 39;
-            case 1099511627776ULL:       return 40;
-            case 2199023255552ULL:       return 41;
-            case 4398046511104ULL:       return 42;
-            case 8796093022208ULL:       return 43;
-            case 17592186044416ULL:      return 44;
-            case 35184372088832ULL:      return 45;
-            case 70368744177664ULL:      return 46;
-            case 140737488355328ULL:     return 47;
-            case 281474976710656ULL:     return 48;
-            case 562949953421312ULL:     return 49;
-            case 1125899906842624ULL:    return 50;
-            case 2251799813685248ULL:    return 51;
-            case 4503599627370496ULL:    return 52;
-            case 9007199254740992ULL:    return 53;
-            case 18014398509481984ULL:   return 54;
-            case 36028797018963968ULL:   return 55;
-            case 72057594037927936ULL:   return 56;
-            case 144115188075855872ULL:  return 57;
-            case 288230376151711744ULL:  return 58;
-            case 576460752303423488ULL:  return 59;
-            case 1152921504606846976ULL: return 60;
-            case 2305843009213693952ULL: return 61;
-            case 4611686018427387904ULL: return 62;
-            case 9223372036854775808ULL: return 63;
+    void init_magics(Magic* magics, U64* table, const bool& rook) {
+        /*
+        Finds a magic number for each square and fills the attack table.
+        magics: ROOK_MAGICS or BISHOP_MAGICS.
+        table: Attack table, large enough for all squares.
+        rook: true for rook, false for bishop.
+        */
+        U64 occupancy[4096], reference[4096];
+        int epoch[4096] = {0};
+        int attempt = 0;
+
+        for (char sq = 0; sq < 64; sq++) {
+            Magic& m = magics[(int)sq];
+            const U64 edges = ((RANK1|RANK8) & ~RANKS[sq>>3]) | ((FILE1|FILE8) & ~FILES[sq&7]);
+            m.mask = ray_attacks(sq, EMPTY, rook) & ~edges;
+            m.shift = 64 - popcnt(m.mask);
+            m.attacks = table;
+            magic_seed = MAGIC_SEEDS[sq>>3];
+
+            // Enumerate all subsets of mask (Carry-Rippler).
+            int size = 0;
+            U64 sub = EMPTY;
+            do {
+                occupancy[size] = sub;
+                reference[size] = ray_attacks(sq, sub, rook);
+                size++;
+                sub = (sub - m.mask) & m.mask;
+            } while (sub != EMPTY);
+
+            #if USE_PEXT
+                // BMI2 indexes directly by extracting the mask bits, no magic needed.
+                for (int i = 0; i < size; i++) m.attacks[_pext_u64(occupancy[i], m.mask)] = reference[i];
+                table += size;
+                continue;
+            #endif
+
+            bool found = false;
+            while (!found) {
+                do m.magic = magic_rand() & magic_rand() & magic_rand();
+                while (popcnt((m.mask * m.magic) >> 56) < 6);
+
+                attempt++;
+                found = true;
+                for (int i = 0; i < size; i++) {
+                    const U64 idx = (occupancy[i] * m.magic) >> m.shift;
+                    if (epoch[idx] < attempt) {
+                        epoch[idx] = attempt;
+                        m.attacks[idx] = reference[i];
+                    } else if (m.attacks[idx] != reference[i]) {
+                        found = false;
+                        break;
+                    }
+                }
+            }
+            table += size;
         }
-        #if DEBUG_MODE
-            std::cerr << "DEBUG: bitboard.cpp, first_bit_char: Bitboard does not have one bit set." << endl;
-        #endif
-        return 0;
     }
 
-    Location first_bit(const U64& board) {
-        return Location(first_bit_char(board));
+    void init() {
+        init_magics(ROOK_MAGICS, ROOK_TABLE, true);
+        init_magics(BISHOP_MAGICS, BISHOP_TABLE, false);
+
+        for (char a = 0; a < 64; a++) {
+            for (char b = 0; b < 64; b++) {
+                const U64 target = 1ULL << b;
+                BETWEEN[(int)a][(int)b] = EMPTY;
+                if (rook_attacks(a, EMPTY) & target) {
+                    BETWEEN[(int)a][(int)b] = rook_attacks(a, target) & rook_attacks(b, 1ULL<<a);
+                } else if (bishop_attacks(a, EMPTY) & target) {
+                    BETWEEN[(int)a][(int)b] = bishop_attacks(a, target) & bishop_attacks(b, 1ULL<<a);
+                }
+            }
+        }
     }
 
 
     string piece_at(const Position& pos, const char& loc) {
-        if (bit(pos.wp, loc)) return "P";
-        else if (bit(pos.wn, loc)) return "N";
-        else if (bit(pos.wb, loc)) return "B";
-        else if (bit(pos.wr, loc)) return "R";
-        else if (bit(pos.wq, loc)) return "Q";
-        else if (bit(pos.wk, loc)) return "K";
-        else if (bit(pos.bp, loc)) return "p";
-        else if (bit(pos.bn, loc)) return "n";
-        else if (bit(pos.bb, loc)) return "b";
-        else if (bit(pos.br, loc)) return "r";
-        else if (bit(pos.bq, loc)) return "q";
-        else if (bit(pos.bk, loc)) return "k";
-        else return " ";
+        const UCH piece = pos.board[(int)loc];
+        return (piece == NO_PIECE) ? " " : string(1, PIECE_SYMBOLS[piece]);
     }
 
     string board_str(const U64& board, const string on, const string off) {
@@ -308,7 +285,7 @@ namespace Bitboard {
         }
         str += "   a   b   c   d   e   f   g   h\n";
         str += "\nFen: " + fen(pos) + "\n";
-        str += "Hash: " + std::to_string(Hash::hash(pos)) + "\n";
+        str += "Hash: " + std::to_string(pos.hash) + "\n";
 
         return str;
     }
@@ -319,10 +296,10 @@ namespace Bitboard {
 
     string move_str(const Move& move) {
         string str;
-        str += square_str(move.from);
-        str += square_str(move.to);
-        if (move.is_promo) {
-            switch (move.promo) {
+        str += square_str(move.from());
+        str += square_str(move.to());
+        if (move.is_promo()) {
+            switch (move.promo()) {
                 case 0: str += "n"; break;
                 case 1: str += "b"; break;
                 case 2: str += "r"; break;
@@ -390,20 +367,8 @@ namespace Bitboard {
                 if (48 <= ch && ch <= 57) {
                     x += (ch-48);
                 } else {
-                    switch (ch) {
-                        case 'P': set_bit(pos.wp, loc); break;
-                        case 'N': set_bit(pos.wn, loc); break;
-                        case 'B': set_bit(pos.wb, loc); break;
-                        case 'R': set_bit(pos.wr, loc); break;
-                        case 'Q': set_bit(pos.wq, loc); break;
-                        case 'K': set_bit(pos.wk, loc); break;
-                        case 'p': set_bit(pos.bp, loc); break;
-                        case 'n': set_bit(pos.bn, loc); break;
-                        case 'b': set_bit(pos.bb, loc); break;
-                        case 'r': set_bit(pos.br, loc); break;
-                        case 'q': set_bit(pos.bq, loc); break;
-                        case 'k': set_bit(pos.bk, loc); break;
-                    }
+                    const size_t piece = string(PIECE_SYMBOLS).find(ch);
+                    if (piece != string::npos) put_piece(pos, piece, loc);
                     x++;
                 }
             }
@@ -429,94 +394,75 @@ namespace Bitboard {
         }
         pos.draw50 = std::stoi(parts[4])*2;
         pos.move_cnt = std::stoi(parts[4])*2-1;
+        pos.hash = Hash::hash(pos);
+        pos.pawn_hash = Hash::pawn_hash(pos);
 
         return pos;
     }
 
-    Move parse_uci(const string& uci) {
-        Move move;
-        move.from = uci[0]-97 + 8*(uci[1]-49);
-        move.to = uci[2]-97 + 8*(uci[3]-49);
-        move.is_promo = (uci.size() >= 5);
-        if (move.is_promo) {
+    Move parse_uci(const Position& pos, const string& uci) {
+        /*
+        Parses a UCI move string.
+        pos: Position the move is played in, needed to derive the move flags.
+        */
+        const char from = uci[0]-97 + 8*(uci[1]-49);
+        const char to = uci[2]-97 + 8*(uci[3]-49);
+        const U64 pawns = pos.bb[WHITE][PAWN] | pos.bb[BLACK][PAWN], kings = pos.bb[WHITE][KING] | pos.bb[BLACK][KING];
+        UCH flags = bit(pos.occupancy[!pos.turn], to) ? Move::CAPTURE : Move::QUIET;
+
+        if (uci.size() >= 5) {
+            flags |= Move::PROMO;
             switch (uci[4]) {
-                case 'N': case 'n': move.promo = 0; break;
-                case 'B': case 'b': move.promo = 1; break;
-                case 'R': case 'r': move.promo = 2; break;
-                case 'Q': case 'q': move.promo = 3; break;
+                case 'N': case 'n': flags |= 0; break;
+                case 'B': case 'b': flags |= 1; break;
+                case 'R': case 'r': flags |= 2; break;
+                case 'Q': case 'q': flags |= 3; break;
             }
+        } else if (bit(pawns, from)) {
+            if (abs(to-from) == 16) flags = Move::DOUBLE_PUSH;
+            else if (pos.ep && to == pos.ep_square) flags = Move::EP_CAPTURE;
+        } else if (bit(kings, from) && abs(to-from) == 2) {
+            flags = (to > from) ? Move::KING_CASTLE : Move::QUEEN_CASTLE;
         }
-        return move;
+        return Move(from, to, flags);
     }
 
 
+    template<Color Us>
     U64 attacked(const U64& pawns, const U64& knights, const U64& bishops, const U64& rooks,
-            const U64& queens, const U64& kings, const U64& opponent, const bool& side) {
+            const U64& queens, const U64& kings, const U64& opponent) {
         /*
         Calculates a bitboard of attacked squares.
+        Us: The side that is attacking.
         pawns, knights, ...: Bitboards from the attacking side.
         opponent: Bitboard of all pieces from other side.
-        side: The side that is attacking.
         return: Bitboard of all attacked squares.
         */
         const U64 pieces = pawns | knights | bishops | rooks | queens | kings | opponent;
-        const char pawn_dir = side ? 1 : -1;
-        U64 board = EMPTY;
-
-        for (char i = 0; i < 64; i++) {
-            const char x = (i&7), y = (i>>3);
-            if (bit(pawns, i)) {
-                const char ny = y + pawn_dir;  // Current (x, y) with y as after capture.
-                if (0 <= ny && ny < 8) {
-                    if (0 <= x-1 && x-1 < 8) set_bit(board, (ny<<3) + x-1);
-                    if (0 <= x+1 && x+1 < 8) set_bit(board, (ny<<3) + x+1);
-                }
-            }
-            if (bit(knights, i)) {
-                for (const auto& dir: DIR_N) {                 // Iterate through all knight moves.
-                    const char nx = x+dir[0], ny = y+dir[1];   // Position after moving.
-                    if (in_board(nx, ny)) set_bit(board, (ny<<3) + nx);
-                }
-            }
-            if (bit(kings, i)) {
-                for (const auto& dir: DIR_K) {
-                    const char nx = x+dir[0], ny = y+dir[1];
-                    if (in_board(nx, ny)) set_bit(board, (ny<<3) + nx);
-                }
-            }
-            if (bit(rooks, i) || bit(queens, i)) {
-                for (const auto& dir: DIR_R) {
-                    char cx = x, cy = y;                  // Current (x, y)
-                    const char dx = dir[0], dy = dir[1];  // Delta (x, y)
-                    while (true) {
-                        cx += dx;
-                        cy += dy;
-                        if (!in_board(cx, cy)) break;
-                        const char loc = (cy<<3) + cx;
-                        set_bit(board, loc);
-                        if (bit(pieces, loc)) break;
-                    }
-                }
-            }
-            if (bit(bishops, i) || bit(queens, i)) {
-                for (const auto& dir: DIR_B) {
-                    char cx = x, cy = y;                  // Current (x, y)
-                    const char dx = dir[0], dy = dir[1];  // Delta (x, y)
-                    while (true) {
-                        cx += dx;
-                        cy += dy;
-                        if (!in_board(cx, cy)) break;
-                        const char loc = (cy<<3) + cx;
-                        set_bit(board, loc);
-                        if (bit(pieces, loc)) break;
-                    }
-                }
+        U64 board = pawn_attacks(pawns, Us);
+
+        U64 remaining = knights | bishops | rooks | queens | kings;
+        while (remaining) {
+            const char i = pop_lsb(remaining);
+            if      (bit(knights, i)) board |= KNIGHT_ATTACKS[i];
+            else if (bit(kings, i))   board |= KING_ATTACKS[i];
+            else {
+                if (bit(rooks, i) || bit(queens, i))   board |= rook_attacks(i, pieces);
+                if (bit(bishops, i) || bit(queens, i)) board |= bishop_attacks(i, pieces);
             }
         }
 
         return board;
     }
 
+    template<Color Us>
+    U64 attacked(const Position& pos) {
+        constexpr Color Them = (Us == WHITE) ? BLACK : WHITE;
+        const U64* const us = pos.bb[Us];
+        const U64 opp = pos.occupancy[Them] ^ pos.bb[Them][KING];
+        return attacked<Us>(us[PAWN], us[KNIGHT], us[BISHOP], us[ROOK], us[QUEEN], us[KING], opp);
+    }
+
     U64 attacked(const Position& pos, const bool& turn) {
         /*
         Wrapper for attacked.
@@ -524,13 +470,118 @@ namespace Bitboard {
         turn: The side that is attacking.
         return: Bitboard of attacks.
         */
-        if (turn) {
-            const U64 opp = pos.bp | pos.bn | pos.bb | pos.br | pos.bq;
-            return attacked(pos.wp, pos.wn, pos.wb, pos.wr, pos.wq, pos.wk, opp, true);
-        } else {
-            const U64 opp = pos.wp | pos.wn | pos.wb | pos.wr | pos.wq;
-            return attacked(pos.bp, pos.bn, pos.bb, pos.br, pos.bq, pos.bk, opp, false);
-        }
+        return turn ? attacked<WHITE>(pos) : attacked<BLACK>(pos);
+    }
+
+    U64 slider_fill(const U64& straight, const U64& diagonal, const U64& empty) {
+        /*
+        Set-wise slider attacks with Kogge-Stone occluded fills, no table lookups.
+        straight: Rooks and queens.
+        diagonal: Bishops and queens.
+        empty: Squares sliders pass through.
+        Each fill runs in a lane: N, E, NW, NE by shifting left and S, W, SE, SW by shifting right.
+        Built with AVX2 the four lanes of each half run in one 256 bit register.
+        */
+        #if USE_AVX2
+            const __m256i shift1 = _mm256_setr_epi64x(8, 1, 7, 9);
+            const __m256i shift2 = _mm256_slli_epi64(shift1, 1), shift4 = _mm256_slli_epi64(shift1, 2);
+            const __m256i l_mask = _mm256_setr_epi64x(FULL, ~FILE1, ~FILE8, ~FILE1);
+            const __m256i r_mask = _mm256_setr_epi64x(FULL, ~FILE8, ~FILE1, ~FILE8);
+            const __m256i gen = _mm256_setr_epi64x(straight, straight, diagonal, diagonal);
+            const __m256i open = _mm256_set1_epi64x(empty);
+
+            __m256i l_gen = gen, l_pro = _mm256_and_si256(open, l_mask);
+            l_gen = _mm256_or_si256(l_gen, _mm256_and_si256(l_pro, _mm256_sllv_epi64(l_gen, shift1)));
+            l_pro = _mm256_and_si256(l_pro, _mm256_sllv_epi64(l_pro, shift1));
+            l_gen = _mm256_or_si256(l_gen, _mm256_and_si256(l_pro, _mm256_sllv_epi64(l_gen, shift2)));
+            l_pro = _mm256_and_si256(l_pro, _mm256_sllv_epi64(l_pro, shift2));
+            l_gen = _mm256_or_si256(l_gen, _mm256_and_si256(l_pro, _mm256_sllv_epi64(l_gen, shift4)));
+
+            __m256i r_gen = gen, r_pro = _mm256_and_si256(open, r_mask);
+            r_gen = _mm256_or_si256(r_gen, _mm256_and_si256(r_pro, _mm256_srlv_epi64(r_gen, shift1)));
+            r_pro = _mm256_and_si256(r_pro, _mm256_srlv_epi64(r_pro, shift1));
+            r_gen = _mm256_or_si256(r_gen, _mm256_and_si256(r_pro, _mm256_srlv_epi64(r_gen, shift2)));
+            r_pro = _mm256_and_si256(r_pro, _mm256_srlv_epi64(r_pro, shift2));
+            r_gen = _mm256_or_si256(r_gen, _mm256_and_si256(r_pro, _mm256_srlv_epi64(r_gen, shift4)));
+
+            const __m256i attacks = _mm256_or_si256(_mm256_and_si256(_mm256_sllv_epi64(l_gen, shift1), l_mask),
+                _mm256_and_si256(_mm256_srlv_epi64(r_gen, shift1), r_mask));
+            __m128i half = _mm_or_si128(_mm256_castsi256_si128(attacks), _mm256_extracti128_si256(attacks, 1));
+            half = _mm_or_si128(half, _mm_unpackhi_epi64(half, half));
+            return _mm_cvtsi128_si64(half);
+        #else
+            constexpr char shifts[4] = {8, 1, 7, 9};
+            constexpr U64 l_masks[4] = {FULL, ~FILE1, ~FILE8, ~FILE1};
+            constexpr U64 r_masks[4] = {FULL, ~FILE8, ~FILE1, ~FILE8};
+            U64 attacks = EMPTY;
+            for (int i = 0; i < 4; i++) {
+                const char s = shifts[i];
+                U64 l_gen = (i < 2) ? straight : diagonal, l_pro = empty & l_masks[i];
+                U64 r_gen = l_gen, r_pro = empty & r_masks[i];
+                l_gen |= l_pro & (l_gen << s);
+                r_gen |= r_pro & (r_gen >> s);
+                l_pro &= l_pro << s;
+                r_pro &= r_pro >> s;
+                l_gen |= l_pro & (l_gen << 2*s);
+                r_gen |= r_pro & (r_gen >> 2*s);
+                l_pro &= l_pro << 2*s;
+                r_pro &= r_pro >> 2*s;
+                l_gen |= l_pro & (l_gen << 4*s);
+                r_gen |= r_pro & (r_gen >> 4*s);
+                attacks |= ((l_gen << s) & l_masks[i]) | ((r_gen >> s) & r_masks[i]);
+            }
+            return attacks;
+        #endif
+    }
+
+    template<Color Us>
+    U64 attacked_setwise(const Position& pos) {
+        // Same result as attacked<Us>, computed without per piece loops.
+        constexpr Color Them = (Us == WHITE) ? BLACK : WHITE;
+        const U64* const us = pos.bb[Us];
+        const U64 empty = ~(pos.occupancy[WHITE] | pos.occupancy[BLACK]) | pos.bb[Them][KING];
+        return pawn_attacks(us[PAWN], Us) | knight_attacks(us[KNIGHT]) | KING_ATTACKS[lsb(us[KING])]
+            | slider_fill(us[ROOK] | us[QUEEN], us[BISHOP] | us[QUEEN], empty);
+    }
+
+    U64 attacked_setwise(const Position& pos, const bool& turn) {
+        return turn ? attacked_setwise<WHITE>(pos) : attacked_setwise<BLACK>(pos);
+    }
+
+    template<Color Us>
+    void attack_info(const Position& pos, AttackInfo& info) {
+        // Fills the attacks and king zone of one side, occupancy must already be set.
+        constexpr Color Them = (Us == WHITE) ? BLACK : WHITE;
+        const U64* const us = pos.bb[Us];
+        const U64 occupied = info.all ^ pos.bb[Them][KING];
+        U64* const attacks = info.by_piece[Us];
+
+        attacks[PAWN] = pawn_attacks(us[PAWN], Us);
+        attacks[KNIGHT] = EMPTY;
+        for (U64 pieces = us[KNIGHT]; pieces;) attacks[KNIGHT] |= KNIGHT_ATTACKS[pop_lsb(pieces)];
+        attacks[BISHOP] = EMPTY;
+        for (U64 pieces = us[BISHOP]; pieces;) attacks[BISHOP] |= bishop_attacks(pop_lsb(pieces), occupied);
+        attacks[ROOK] = EMPTY;
+        for (U64 pieces = us[ROOK]; pieces;) attacks[ROOK] |= rook_attacks(pop_lsb(pieces), occupied);
+        attacks[QUEEN] = EMPTY;
+        for (U64 pieces = us[QUEEN]; pieces;) attacks[QUEEN] |= queen_attacks(pop_lsb(pieces), occupied);
+        const char k = lsb(us[KING]);
+        attacks[KING] = KING_ATTACKS[k];
+
+        info.by_side[Us] = attacks[PAWN] | attacks[KNIGHT] | attacks[BISHOP] | attacks[ROOK] | attacks[QUEEN] | attacks[KING];
+        info.king_zone[Us] = KING_ATTACKS[k] | (1ULL<<k);
+    }
+
+    void attack_info(const Position& pos, AttackInfo& info) {
+        /*
+        Computes the attack maps of both sides.
+        info: Filled with attacks, occupancy and king zones.
+        */
+        info.occupancy[WHITE] = pos.occupancy[WHITE];
+        info.occupancy[BLACK] = pos.occupancy[BLACK];
+        info.all = info.occupancy[WHITE] | info.occupancy[BLACK];
+        attack_info<WHITE>(pos, info);
+        attack_info<BLACK>(pos, info);
     }
 
     char num_attacks(const vector<Move>& moves, const Location& sq) {
@@ -538,597 +589,435 @@ namespace Bitboard {
 
         char cnt = 0;
         for (const auto& move: moves) {
-            if (move.to == sq.loc) cnt++;
+            if (move.to() == sq.loc) cnt++;
         }
         return cnt;
     }
 
-    U64 pinned(const Location& k_pos, const Location& piece_pos, const U64& pawns, const U64& knights, const U64& bishops,
-            const U64& rooks, const U64& queens, const U64& kings, const U64& same) {
+    template<Color Us>
+    void move_masks(MoveMasks& masks, const Position& pos, const char& k) {
         /*
-        Calculates a bitboard of all squares the piece at piece_pos can move to.
-        If the piece is not pinned, it will return FULL.
-        k_pos: King pos of current side.
-        piece_pos: Position of piece to check if pinned.
-        pawns, knights, ...: Enemy bitboards.
-        same: Bitboard of all same side pieces.
+        Computes the checkers, check mask and pins of the side to move in one pass.
+        Us: Side to move.
+        k: King square of current side.
         */
-        U64 pin_ray = EMPTY;
-        const U64 all = pawns | knights | bishops | rooks | queens | kings | same;
-        const char kx = k_pos.x, ky = k_pos.y;
-        const char px = piece_pos.x, py = piece_pos.y;
-        char dx = px - kx, dy = py - ky;
-        bool found = false;  // true = piece is pinned, false = piece is not pinned.
-
-        if (dx > 0) dx = 1;
-        else if (dx < 0) dx = -1;
-        if (dy > 0) dy = 1;
-        else if (dy < 0) dy = -1;
-
-        if (!(dx == 0 && dy == 0)) {
-            if ((dx == 0 && dy != 0) || (dx != 0 && dy == 0)) {   // Rook
-                char cx = kx, cy = ky;   // Current (x, y)
-                while (true) {
-                    cx += dx;
-                    cy += dy;
-                    if (!in_board(cx, cy)) {
-                        found = false;
-                        break;
-                    }
-                    const char loc = (cy<<3) + cx;
-                    set_bit(pin_ray, loc);
-                    if (cx==px && cy==py) found = true;
-                    else if (bit(rooks, loc) || bit(queens, loc)) break;
-                    else if (bit(all, loc)) {
-                        found = false;
-                        break;
-                    }
-                }
-            } else if (abs(dx) == abs(dy)) {   // Bishop
-                char cx = kx, cy = ky;   // Current (x, y)
-                while (true) {
-                    cx += dx;
-                    cy += dy;
-                    if (!in_board(cx, cy)) {
-                        found = false;
-                        break;
-                    }
-                    const char loc = (cy<<3) + cx;
-                    set_bit(pin_ray, loc);
-                    if (cx==px && cy==py) found = true;
-                    else if (bit(bishops, loc) || bit(queens, loc)) break;
-                    else if (bit(all, loc)) {
-                        found = false;
-                        break;
-                    }
-                }
+        constexpr Color Them = (Us == WHITE) ? BLACK : WHITE;
+        const U64* const them = pos.bb[Them];
+        const U64 SAME = pos.occupancy[Us], OPPONENT = pos.occupancy[Them], all = SAME | OPPONENT;
+        const U64 diagonal = them[BISHOP] | them[QUEEN], straight = them[ROOK] | them[QUEEN];
+        masks.checkers = (PAWN_ATTACKS[Us][k] & them[PAWN]) | (KNIGHT_ATTACKS[k] & them[KNIGHT]) |
+            (bishop_attacks(k, all) & diagonal) | (rook_attacks(k, all) & straight);
+        masks.check_mask = masks.checkers ? BETWEEN[(int)k][(int)lsb(masks.checkers)] | masks.checkers : FULL;
+
+        // X-ray through own pieces, a slider with exactly one own piece in between pins it.
+        masks.pinned = EMPTY;
+        U64 snipers = (rook_attacks(k, OPPONENT) & straight) | (bishop_attacks(k, OPPONENT) & diagonal);
+        while (snipers) {
+            const char sniper = pop_lsb(snipers);
+            const U64 between = BETWEEN[(int)k][(int)sniper] & all;
+            if (between && !(between & (between-1)) && (between & SAME)) {
+                masks.pinned |= between;
+                masks.pin_rays[(int)lsb(between)] = BETWEEN[(int)k][(int)sniper] | (1ULL<<sniper);
             }
         }
-
-        return (found ? pin_ray : FULL);
     }
 
-    U64 checkers(const Location& k_pos, const U64& pawns, const U64& knights, const U64& bishops, const U64& rooks,
-            const U64& queens, const U64& kings, const U64& same_side, const U64& attackers, const bool& side) {
+    template<Color Us>
+    bool ep_legal(const Position& pos, const char& k, const char& from, const MoveMasks& masks) {
         /*
-        Calculates bitboard of checking pieces.
-        k_pos: King position.
-        pawns, knights, ...: Boards of enemy pieces.
-        same_side: Same side pieces.
-        attackers: Attacks of enemy.
-        side: true if white else false.
+        En passant is legal if it resolves any check and no slider sees the king once both pawns are gone.
+        from: Square of the capturing pawn.
         */
-        U64 board = EMPTY;
-        char atk_cnt = 0;  // Attacker count, can also be thought of as number of attackers.
-        const char kx = k_pos.x, ky = k_pos.y;
-        if (!bit(attackers, k_pos.loc)) return board;
-        const U64 pieces = pawns | knights | bishops | rooks | queens | kings;
-        const char pawn_dir = side ? -1 : 1;
-
-        // Pawns
-        const char y = ky - pawn_dir;
-        if (0 <= y && y < 8) {
-            const char loc = (y<<3) + kx;
-            if (0 <= kx-1 && kx-1 < 8) {
-                if (bit(pawns, loc-1)) {
-                    atk_cnt++;
-                    set_bit(board, loc-1);
-                }
-            }
-            if (0 <= kx+1 && kx+1 < 8) {
-                if (bit(pawns, loc+1)) {
-                    atk_cnt++;
-                    set_bit(board, loc+1);
-                }
-            }
-        }
+        constexpr Color Them = (Us == WHITE) ? BLACK : WHITE;
+        constexpr char pawn_dir = (Us == WHITE) ? 8 : -8;
+        const char captured = pos.ep_square - pawn_dir;
+        if (!bit(masks.check_mask, pos.ep_square) && !bit(masks.checkers, captured)) return false;
+
+        const U64* const them = pos.bb[Them];
+        const U64 all = pos.occupancy[WHITE] | pos.occupancy[BLACK];
+        const U64 occupied = (all ^ (1ULL<<from) ^ (1ULL<<captured)) | (1ULL<<pos.ep_square);
+        return !(rook_attacks(k, occupied) & (them[ROOK]|them[QUEEN]))
+            && !(bishop_attacks(k, occupied) & (them[BISHOP]|them[QUEEN]));
+    }
 
-        // Knights
-        for (const auto& dir: DIR_N) {
-            const char x = kx + dir[0], y = ky + dir[1];
-            if (in_board(x, y)) {
-                const char loc = (y<<3) + x;
-                if (bit(knights, loc)) {
-                    set_bit(board, loc);
-                    if (atk_cnt++ > 1) return board;
-                    break;
-                }
-            }
-        }
+    void add_moves(Move* moves, int& movecnt, const char& from, const U64& targets, const U64& opponent) {
+        // Adds a move from one square to every target, flagging captures.
+        U64 captures = targets & opponent, quiets = targets & ~opponent;
+        while (captures) moves[movecnt++] = Move(from, pop_lsb(captures), Move::CAPTURE);
+        while (quiets) moves[movecnt++] = Move(from, pop_lsb(quiets));
+    }
 
-        // Bishops and part queens
-        for (const auto& dir: DIR_B) {
-            char x = kx, y = ky;
-            while (true) {
-                x += dir[0];
-                y += dir[1];
-                if (!in_board(x, y)) break;
-                const char loc = (y<<3) + x;
-                if (bit(same_side, loc)) break;
-                if (bit(bishops, loc) || bit(queens, loc)) {
-                    set_bit(board, loc);
-                    if (atk_cnt++ > 1) return board;
-                    break;
-                }
-                if (bit(pieces, loc)) break;
-            }
-        }
-
-        // Rooks and part queens
-        for (const auto& dir: DIR_R) {
-            char x = kx, y = ky;
-            while (true) {
-                x += dir[0];
-                y += dir[1];
-                if (!in_board(x, y)) break;
-                const char loc = (y<<3) + x;
-                if (bit(same_side, loc)) break;
-                if (bit(rooks, loc) || bit(queens, loc)) {
-                    set_bit(board, loc);
-                    if (atk_cnt++ > 1) return board;
-                    break;
-                }
-                if (bit(pieces, loc)) break;
-            }
+    U64 gen_mask(const GenType& type, const U64& opponent) {
+        // Target squares allowed for non pawn moves of the given type.
+        switch (type) {
+            case GEN_CAPTURES: return opponent;
+            case GEN_QUIETS: return ~opponent;
+            default: return FULL;
         }
+    }
 
-        return board;
+    template<Color Us>
+    U64 castle_targets(const UCH& castling, const U64& all, const U64& attacks) {
+        /*
+        Squares the king can castle to.
+        castling: Castling rights.
+        all: board of all pieces.
+        attacks: attacks from enemy.
+        */
+        constexpr UCH kside = (Us == WHITE) ? 0 : 2, qside = kside + 1;
+        constexpr char rank = (Us == WHITE) ? 0 : 56;
+        constexpr U64 k_empty = 3ULL << (rank+5), q_empty = 7ULL << (rank+1);
+        constexpr U64 k_safe = (Us == WHITE) ? CASTLING_WK : CASTLING_BK, q_safe = (Us == WHITE) ? CASTLING_WQ : CASTLING_BQ;
+
+        U64 targets = EMPTY;
+        if (bit(castling, kside) && !(all & k_empty) && !(attacks & k_safe)) set_bit(targets, rank+6);
+        if (bit(castling, qside) && !(all & q_empty) && !(attacks & q_safe)) set_bit(targets, rank+2);
+        return targets;
     }
 
-    void king_moves(Move* moves, int& movecnt, const Location& k_pos, const UCH& castling, const bool& side, const U64& same,
-            const U64& all, const U64& attacks) {
+    template<Color Us>
+    void king_moves(Move* moves, int& movecnt, const char& k, const UCH& castling, const U64& same, const U64& all,
+            const U64& attacks, const GenType& type) {
         /*
         Calculates all king moves.
-        k_pos: King position.
+        k: King square.
         castling: Castling rights.
-        side: true if white else false
         same: board of same pieces.
         all: board of all pieces.
         attacks: attacks from enemy.
+        type: Which moves to generate.
         */
-        const char kx = k_pos.x, ky = k_pos.y;
+        const U64 opponent = all & ~same;
+        add_moves(moves, movecnt, k, KING_ATTACKS[k] & ~attacks & ~same & gen_mask(type, opponent), opponent);
 
-        for (const auto& dir: DIR_K) {
-            const char x = kx+dir[0], y = ky+dir[1];
-            if (in_board(x, y)) {
-                const char loc = (y<<3) + x;
-                if (!bit(attacks, loc) && !bit(same, loc)) moves[movecnt++] = Move(k_pos.loc, loc);
-            }
+        // Castling
+        if (type == GEN_CAPTURES) return;
+        U64 castles = castle_targets<Us>(castling, all, attacks);
+        while (castles) {
+            const char to = pop_lsb(castles);
+            moves[movecnt++] = Move(k, to, ((to&7) == 6) ? Move::KING_CASTLE : Move::QUEEN_CASTLE);
         }
+    }
 
-        // Castling
-        if (side) {
-            if (bit(castling, 0)) {
-                if (!bit(all, 5) && !bit(all, 6)) {
-                    if ((CASTLING_WK & attacks) == EMPTY) moves[movecnt++] = Move(k_pos.loc, 6);
+    template<Color Us>
+    void piece_moves(Move* moves, int& movecnt, const Position& pos, const char& k, const MoveMasks& masks,
+            const GenType& type) {
+        /*
+        Computes all moves of pieces other than the king.
+        Targets are masked by the check mask, and by the pin ray for pinned pieces.
+        */
+        constexpr Color Them = (Us == WHITE) ? BLACK : WHITE;
+        constexpr char pawn_dir = (Us == WHITE) ? 8 : -8;
+        constexpr U64 start_rank = (Us == WHITE) ? RANK2 : RANK7, promo_rank = (Us == WHITE) ? RANK8 : RANK1;
+        const U64* const us = pos.bb[Us];
+        const bool noisy = (type != GEN_QUIETS), quiet = (type != GEN_CAPTURES);
+        const U64 SAME = pos.occupancy[Us], OPPONENT = pos.occupancy[Them], ALL = SAME | OPPONENT;
+        const U64 target = masks.check_mask & gen_mask(type, OPPONENT) & ~SAME;
+
+        U64 pawns = us[PAWN];
+        while (pawns) {
+            const char from = pop_lsb(pawns);
+            const U64 ray = bit(masks.pinned, from) ? masks.pin_rays[(int)from] : FULL;
+            const U64 pawn_mask = masks.check_mask & ray;
+
+            // Forward
+            const char to = from + pawn_dir;
+            if (!bit(ALL, to)) {
+                if (bit(pawn_mask, to)) {
+                    if (bit(promo_rank, to)) {
+                        if (noisy) for (UCH p = 0; p < 4; p++) moves[movecnt++] = Move(from, to, Move::PROMO+p);
+                    } else if (quiet) moves[movecnt++] = Move(from, to);
                 }
-            }
-            if (bit(castling, 1)) {
-                if (!bit(all, 1) && !bit(all, 2) && !bit(all, 3)) {
-                    if ((CASTLING_WQ & attacks) == EMPTY) moves[movecnt++] = Move(k_pos.loc, 2);
+                const char to2 = to + pawn_dir;
+                if (quiet && bit(start_rank, from) && !bit(ALL, to2) && bit(pawn_mask, to2)) {
+                    moves[movecnt++] = Move(from, to2, Move::DOUBLE_PUSH);
                 }
             }
-        } else {
-            if (bit(castling, 2)) {
-                if (!bit(all, 61) && !bit(all, 62)) {
-                    if ((CASTLING_BK & attacks) == EMPTY) moves[movecnt++] = Move(k_pos.loc, 62);
-                }
+            if (!noisy) continue;
+
+            // Captures
+            U64 targets = PAWN_ATTACKS[Us][from] & OPPONENT & pawn_mask;
+            while (targets) {
+                const char capture = pop_lsb(targets);
+                if (bit(promo_rank, capture)) {
+                    for (UCH p = 0; p < 4; p++) moves[movecnt++] = Move(from, capture, Move::PROMO+Move::CAPTURE+p);
+                } else moves[movecnt++] = Move(from, capture, Move::CAPTURE);
             }
-            if (bit(castling, 3)) {
-                if (!bit(all, 57) && !bit(all, 58) && !bit(all, 59)) {
-                    if ((CASTLING_BQ & attacks) == EMPTY) moves[movecnt++] = Move(k_pos.loc, 58);
-                }
+
+            if (pos.ep && bit(PAWN_ATTACKS[Us][from], pos.ep_square) && ep_legal<Us>(pos, k, from, masks)) {
+                moves[movecnt++] = Move(from, pos.ep_square, Move::EP_CAPTURE);
             }
         }
+
+        // Knights cannot move while pinned.
+        U64 knights = us[KNIGHT] & ~masks.pinned;
+        while (knights) {
+            const char from = pop_lsb(knights);
+            add_moves(moves, movecnt, from, KNIGHT_ATTACKS[from] & target, OPPONENT);
+        }
+
+        U64 diagonal = us[BISHOP] | us[QUEEN];
+        while (diagonal) {
+            const char from = pop_lsb(diagonal);
+            const U64 ray = bit(masks.pinned, from) ? masks.pin_rays[(int)from] : FULL;
+            add_moves(moves, movecnt, from, bishop_attacks(from, ALL) & target & ray, OPPONENT);
+        }
+
+        U64 straight = us[ROOK] | us[QUEEN];
+        while (straight) {
+            const char from = pop_lsb(straight);
+            const U64 ray = bit(masks.pinned, from) ? masks.pin_rays[(int)from] : FULL;
+            add_moves(moves, movecnt, from, rook_attacks(from, ALL) & target & ray, OPPONENT);
+        }
     }
 
-    void single_check_moves(Move* moves, int& movecnt, const Position& pos, const U64& SP, const U64& SN, const U64& SB, const U64& SR,
-            const U64& SQ, const U64& SK, const U64& OP, const U64& ON, const U64& OB, const U64& OR, const U64& OQ, const U64& OK,
-            const U64& SAME, const U64& OPPONENT, const U64& ALL, const Location& k_pos, const U64& checking_pieces) {
-        /*
-        Computes all moves when there is one check.
-        */
-        // Block and capture piece giving check to king
-        U64 block_mask = EMPTY;
-        const U64 capture_mask = checking_pieces;
-        const char pawn_dir = pos.turn ? 1 : -1;
-        const bool pawn_check = (OP & checking_pieces) != EMPTY;
-
-        const Location check_pos = first_bit(checking_pieces);
-        const char check_x = check_pos.x, check_y = check_pos.y;
-
-        const char kx = k_pos.x, ky = k_pos.y;
-        char dx = check_x - kx, dy = check_y - ky;
-        // If not a knight move create the mask
-        if (!((abs(dx)==2 && abs(dy)==1) || (abs(dy)==2 && abs(dx)==1))) {
-            if (dx > 0) dx = 1;
-            else if (dx < 0) dx = -1;
-            if (dy > 0) dy = 1;
-            else if (dy < 0) dy = -1;
-
-            char cx = kx, cy = ky;   // Current (x, y)
-            while (true) {
-                cx += dx;
-                cy += dy;
-                const char loc = (cy<<3) + cx;
-                if (bit(checking_pieces, loc)) break;
-                set_bit(block_mask, loc);
+    template<Color Us>
+    void legal_moves(const Position& pos, const AttackInfo& info, MoveList& moves, const GenType& type) {
+        constexpr Color Them = (Us == WHITE) ? BLACK : WHITE;
+        const char k = lsb(pos.bb[Us][KING]);
+        MoveMasks masks;
+        move_masks<Us>(masks, pos, k);
+
+        Move* const list = moves.moves;
+        int& movecnt = moves.count;
+        movecnt = 0;
+        // Only the king can move in double check.
+        if (!(masks.checkers & (masks.checkers-1))) piece_moves<Us>(list, movecnt, pos, k, masks, type);
+        king_moves<Us>(list, movecnt, k, pos.castling, info.occupancy[Us], info.all, info.by_side[Them], type);
+    }
+
+    void legal_moves(const Position& pos, const AttackInfo& info, MoveList& moves, const GenType& type) {
+        // Fills moves with all legal moves of the given type.
+        if (pos.turn) legal_moves<WHITE>(pos, info, moves, type);
+        else legal_moves<BLACK>(pos, info, moves, type);
+    }
+
+    template<Color Us>
+    int count_moves(const Position& pos, const AttackInfo& info) {
+        constexpr Color Them = (Us == WHITE) ? BLACK : WHITE;
+        constexpr char pawn_dir = (Us == WHITE) ? 8 : -8;
+        constexpr U64 start_rank = (Us == WHITE) ? RANK2 : RANK7, last_rank = (Us == WHITE) ? RANK7 : RANK2;
+        const U64* const us = pos.bb[Us];
+        const U64 SAME = info.occupancy[Us], OPPONENT = info.occupancy[Them], ALL = info.all;
+        const U64 attacks = info.by_side[Them];
+        const char k = lsb(us[KING]);
+
+        int count = popcnt(KING_ATTACKS[k] & ~attacks & ~SAME) + popcnt(castle_targets<Us>(pos.castling, ALL, attacks));
+
+        MoveMasks masks;
+        move_masks<Us>(masks, pos, k);
+        if (masks.checkers & (masks.checkers-1)) return count;
+        const U64 target = masks.check_mask & ~SAME;
+
+        U64 pawns = us[PAWN];
+        while (pawns) {
+            const char from = pop_lsb(pawns);
+            const U64 pawn_mask = masks.check_mask & (bit(masks.pinned, from) ? masks.pin_rays[(int)from] : FULL);
+            const int moves_per_target = bit(last_rank, from) ? 4 : 1;  // One per promotion piece
+
+            const char to = from + pawn_dir;
+            if (!bit(ALL, to)) {
+                if (bit(pawn_mask, to)) count += moves_per_target;
+                if (bit(start_rank, from) && !bit(ALL, to+pawn_dir) && bit(pawn_mask, to+pawn_dir)) count++;
             }
+            count += moves_per_target * popcnt(PAWN_ATTACKS[Us][from] & OPPONENT & pawn_mask);
+
+            if (pos.ep && bit(PAWN_ATTACKS[Us][from], pos.ep_square) && ep_legal<Us>(pos, k, from, masks)) count++;
         }
 
-        const U64 full_mask = block_mask | capture_mask;
-
-        // Go through all pieces and check if they can capture/block
-        for (char i = 0; i < 64; i++) {
-            const Location curr_loc(i);
-            if (bit(SAME, i) && pinned(k_pos, curr_loc, OP, ON, OB, OR, OQ, OK, SAME) == FULL) {
-                if (bit(SP, i)) {
-                    const char x = curr_loc.x;
-                    char y;
-
-                    // Block
-                    y = curr_loc.y;
-                    const char speed = (y == (pos.turn ? 1 : 6)) ? 2 : 1;  // If white check rank 6 else rank 1 if on that rank 2 else 1
-                    if (pos.turn) {
-                        for (char cy = y + 1; cy < y + speed + 1; cy++) {
-                            const char loc = (cy<<3) + x;
-                            if (bit(ALL, loc)) break;
-                            if (bit(block_mask, loc)) {
-                                if (cy == 7) {
-                                    // Promotion
-                                    for (const char& p: {0, 1, 2, 3}) moves[movecnt++] = Move(i, loc, true, p);
-                                } else moves[movecnt++] = Move(i, loc);
-                                break;
-                            }
-                        }
-                    } else {
-                        for (char cy = y - 1; cy > y - speed - 1; cy--) {
-                            const char loc = (cy<<3) + x;
-                            if (bit(ALL, loc)) break;
-                            if (bit(block_mask, loc)) {
-                                if (cy == 0) {
-                                    // Promotion
-                                    for (const char& p: {0, 1, 2, 3}) moves[movecnt++] = Move(i, loc, true, p);
-                                } else moves[movecnt++] = Move(i, loc);
-                                break;
-                            }
-                        }
-                    }
-                    // Capture
-                    y += pawn_dir;
-                    if (0 <= y && y < 8) {
-                        const bool promo = y == 7 || y == 0;
-                        for (const auto& offset: {x-1, x+1}) {
-                            if (0 <= offset && offset < 8) {
-                                const char move_loc = (y<<3) + offset;
-                                if (bit(capture_mask, move_loc) && bit(OPPONENT, move_loc)) {
-                                    if (promo) {
-                                        for (const char& p: {0, 1, 2, 3}) moves[movecnt++] = Move(i, move_loc, true, p);
-                                    } else moves[movecnt++] = Move(i, move_loc);
-                                }
-                                if (pos.ep && (move_loc == pos.ep_square)) {
-                                    if (bit(block_mask, move_loc)) moves[movecnt++] = Move(i, move_loc);  // If ep capture can block check.
-                                    else if (pawn_check) moves[movecnt++] = Move(i, move_loc);  // If in check by pawn with possible ep capture.
-                                }
-                            }
-                        }
-                    }
-                } else if (bit(SN, i)) {
-                    const char x = curr_loc.x, y = curr_loc.y;
-                    for (const auto& dir: DIR_N) {
-                        char cx = x + dir[0], cy = y + dir[1];       // Current (x, y)
-                        if (!in_board(cx, cy)) continue;
-                        const char loc = (cy<<3) + cx;
-                        if (bit(full_mask, loc)) moves[movecnt++] = Move(i, loc);
-                    }
-                } else if (bit(SB, i) || bit(SQ, i)) {
-                    // Capture and block
-                    for (const auto& dir: DIR_B) {
-                        char cx = curr_loc.x, cy = curr_loc.y;       // Current (x, y)
-                        const char dx = dir[0], dy = dir[1];         // Delta (x, y)
-                        while (true) {
-                            cx += dx;
-                            cy += dy;
-                            if (!in_board(cx, cy)) break;
-                            const char loc = (cy<<3) + cx;
-                            if (bit(SAME, loc)) break;
-                            if (bit(full_mask, loc)) {
-                                moves[movecnt++] = Move(i, loc);
-                                break;
-                            }
-                            if (bit(OPPONENT, loc)) break;
-                        }
-                    }
-                }
-                if (bit(SR, i) || bit(SQ, i)) {
-                    // Capture and block
-                    for (const auto& dir: DIR_R) {
-                        char cx = curr_loc.x, cy = curr_loc.y;       // Current (x, y)
-                        const char dx = dir[0], dy = dir[1];         // Delta (x, y)
-                        while (true) {
-                            cx += dx;
-                            cy += dy;
-                            if (!in_board(cx, cy)) break;
-                            const char loc = (cy<<3) + cx;
-                            if (bit(SAME, loc)) break;
-                            if (bit(full_mask, loc)) {
-                                moves[movecnt++] = Move(i, loc);
-                                break;
-                            }
-                            if (bit(OPPONENT, loc)) break;
-                        }
-                    }
-                }
-            }
+        U64 knights = us[KNIGHT] & ~masks.pinned;
+        while (knights) count += popcnt(KNIGHT_ATTACKS[pop_lsb(knights)] & target);
+
+        U64 diagonal = us[BISHOP] | us[QUEEN];
+        while (diagonal) {
+            const char from = pop_lsb(diagonal);
+            const U64 ray = bit(masks.pinned, from) ? masks.pin_rays[(int)from] : FULL;
+            count += popcnt(bishop_attacks(from, ALL) & target & ray);
+        }
+
+        U64 straight = us[ROOK] | us[QUEEN];
+        while (straight) {
+            const char from = pop_lsb(straight);
+            const U64 ray = bit(masks.pinned, from) ? masks.pin_rays[(int)from] : FULL;
+            count += popcnt(rook_attacks(from, ALL) & target & ray);
         }
+
+        return count;
     }
 
-    void no_check_moves(Move* moves, int& movecnt, const Position& pos, const U64& SP, const U64& SN, const U64& SB, const U64& SR,
-            const U64& SQ, const U64& SK, const U64& OP, const U64& ON, const U64& OB, const U64& OR, const U64& OQ, const U64& OK,
-            const U64& SAME, const U64& OPPONENT, const U64& ALL, const Location& k_pos, const U64& checking_pieces) {
+    int count_moves(const Position& pos, const AttackInfo& info) {
         /*
-        Computes all moves when there is no check.
+        Counts the legal moves without generating them, same rules as legal_moves.
+        Used for bulk counting at the last ply of perft.
         */
-        const char pawn_dir = pos.turn ? 1 : -1;
-        const U64 o_horiz_pieces = OQ | OR;
-
-        for (char i = 0; i < 64; i++) {
-            const Location curr_loc(i);
-            if (bit(SAME, i)) {
-                const U64 pin = pinned(k_pos, curr_loc, OP, ON, OB, OR, OQ, OK, SAME);
-                const bool piece_pinned = (pin != FULL);
-
-                if (bit(SP, i)) {
-                    // Forward
-                    const char speed = (curr_loc.y == (pos.turn ? 1 : 6)) ? 2 : 1;  // Set speed to 2 if pawn's first move.
-                    if (pos.turn) {
-                        for (char cy = curr_loc.y + 1; cy < curr_loc.y + speed + 1; cy++) {
-                            const char loc = (cy<<3) + curr_loc.x;
-                            if (bit(ALL, loc)) break;
-                            if (bit(pin, loc)) {
-                                if (cy == 7) {
-                                    // Promotion
-                                    for (const char& p: {0, 1, 2, 3}) moves[movecnt++] = Move(i, loc, true, p);
-                                } else moves[movecnt++] = Move(i, loc);
-                            }
-                        }
-                    } else {
-                        for (char cy = curr_loc.y - 1; cy > curr_loc.y - speed - 1; cy--) {
-                            const char loc = (cy<<3) + curr_loc.x;
-                            if (bit(ALL, loc)) break;
-                            if (bit(pin, loc)) {
-                                if (cy == 0) {
-                                    // Promotion
-                                    for (const char& p: {0, 1, 2, 3}) moves[movecnt++] = Move(i, loc, true, p);
-                                } else moves[movecnt++] = Move(i, loc);
-                            }
-                        }
-                    }
-                    // Captures
-                    const char new_y = curr_loc.y + pawn_dir;
-                    if (0 <= new_y && new_y < 8) {
-                        const bool promo = (new_y == 0) || (new_y == 7);
-                        for (const auto& offset: {curr_loc.x-1, curr_loc.x+1}) {
-                            if (0 <= offset && offset < 8) {
-                                const char loc_move = (new_y<<3) + offset;
-                                if (bit(pin, loc_move) && bit(OPPONENT, loc_move)) {
-                                    if (promo) {
-                                        for (const char& p: {0, 1, 2, 3}) moves[movecnt++] = Move(i, loc_move, true, p);
-                                    } else moves[movecnt++] = Move(i, loc_move);
-                                }
-                                if (pos.ep && (loc_move == pos.ep_square)) {
-                                    if (!piece_pinned && ((o_horiz_pieces & RANKS[curr_loc.y]) != EMPTY) && ((SK & RANKS[curr_loc.y]) != EMPTY)) {
-                                        U64 tmp_op = OP;
-                                        unset_bit(tmp_op, pos.ep_square-pawn_dir*8);
-                                        if (pinned(k_pos, curr_loc, tmp_op, ON, OB, OR, OQ, OK, SAME) == FULL) moves[movecnt++] = Move(i, loc_move);
-                                    } else if (bit(pin, loc_move)) moves[movecnt++] = Move(i, loc_move);
-                                }
-                            }
-                        }
-                    }
-                } else if (bit(SN, i)) {
-                    // Knights cannot move while pinned.
-                    if (piece_pinned) continue;
-                    else {
-                        for (const auto& dir: DIR_N) {
-                            const char x = curr_loc.x + dir[0], y = curr_loc.y + dir[1];   // Current (x, y)
-                            if (!in_board(x, y)) continue;
-                            const char loc = (y<<3) + x;
-                            if (!bit(SAME, loc)) moves[movecnt++] = Move(i, loc);
-                        }
-                    }
-                } else if (bit(SB, i) || bit(SQ, i)) {
-                    for (const auto& dir: DIR_B) {
-                        char cx = curr_loc.x, cy = curr_loc.y;       // Current (x, y)
-                        const char dx = dir[0], dy = dir[1];         // Delta (x, y
-                        while (true) {
-                            cx += dx;
-                            cy += dy;
-                            if (!in_board(cx, cy)) break;
-                            const char loc = (cy<<3) + cx;
-                            if (bit(SAME, loc)) break;
-                            if (bit(pin, loc)) moves[movecnt++] = Move(i, loc);
-                            if (bit(OPPONENT, loc)) break;
-                        }
-                    }
-                }
-                if (bit(SR, i) || bit(SQ, i)) {
-                    for (const auto& dir: DIR_R) {
-                        char cx = curr_loc.x, cy = curr_loc.y;       // Current (x, y)
-                        const char dx = dir[0], dy = dir[1];         // Delta (x, y)
-                        while (true) {
-                            cx += dx;
-                            cy += dy;
-                            if (!in_board(cx, cy)) break;
-                            const char loc = (cy<<3) + cx;
-                            if (bit(SAME, loc)) break;
-                            if (bit(pin, loc)) moves[movecnt++] = Move(i, loc);
-                            if (bit(OPPONENT, loc)) break;
-                        }
-                    }
+        return pos.turn ? count_moves<WHITE>(pos, info) : count_moves<BLACK>(pos, info);
+    }
+
+
+    bool is_pseudo_legal(const Position& pos, const Move& move) {
+        /*
+        Checks that a move, e.g. from the transposition table, fits the position apart from king safety.
+        Flags must match too, so a quiet move never gets played as a capture.
+        */
+        const char from = move.from(), to = move.to();
+        const UCH piece = pos.board[(int)from];
+        if (piece == NO_PIECE || color_of(piece) != pos.turn || from == to) return false;
+        if (!move.is_promo() && move.flags() > Move::EP_CAPTURE) return false;
+
+        const U64 same = pos.occupancy[pos.turn], opponent = pos.occupancy[!pos.turn];
+        const U64 all = same | opponent;
+        if (bit(same, to)) return false;
+        if (move.is_ep()) {
+            if (type_of(piece) != PAWN || !pos.ep || to != pos.ep_square) return false;
+            return bit(PAWN_ATTACKS[pos.turn][from], to);
+        }
+        if (move.is_capture() != bit(opponent, to)) return false;
+
+        switch (type_of(piece)) {
+            case PAWN: {
+                const char pawn_dir = pos.turn ? 8 : -8;
+                if (move.is_promo() != bit(RANK1|RANK8, to)) return false;
+                if (move.is_castle()) return false;
+                if (move.is_capture()) return bit(PAWN_ATTACKS[pos.turn][from], to);
+                if (move.flags() == Move::DOUBLE_PUSH) {
+                    return bit(pos.turn ? RANK2 : RANK7, from) && to == from+2*pawn_dir && !bit(all, from+pawn_dir);
                 }
+                return to == from+pawn_dir;
             }
+            case KING:
+                if (move.is_castle()) {
+                    // Attacks on the path are checked by is_legal.
+                    if (from != (pos.turn ? 4 : 60)) return false;
+                    if ((to&7) != ((move.flags() == Move::KING_CASTLE) ? 6 : 2)) return false;
+                    const U64 castles = pos.turn ? castle_targets<WHITE>(pos.castling, all, EMPTY)
+                        : castle_targets<BLACK>(pos.castling, all, EMPTY);
+                    return bit(castles, to);
+                }
+                if (move.is_promo() || move.flags() == Move::DOUBLE_PUSH) return false;
+                return bit(KING_ATTACKS[from], to);
+            default:
+                if (move.is_promo() || move.flags() == Move::DOUBLE_PUSH || move.is_castle()) return false;
+                switch (type_of(piece)) {
+                    case KNIGHT: return bit(KNIGHT_ATTACKS[from], to);
+                    case BISHOP: return bit(bishop_attacks(from, all), to);
+                    case ROOK: return bit(rook_attacks(from, all), to);
+                    default: return bit(queen_attacks(from, all), to);
+                }
         }
     }
 
-    vector<Move> legal_moves(const Position pos, const U64& attacks) {
-        // Pass in attacks from opponent.
-        // Current and opponent pieces and sides
-        U64 SP, SN, SB, SR, SQ, SK, OP, ON, OB, OR, OQ, OK;
-        if (pos.turn) {
-            SP = pos.wp;
-            SN = pos.wn;
-            SB = pos.wb;
-            SR = pos.wr;
-            SQ = pos.wq;
-            SK = pos.wk;
-            OP = pos.bp;
-            ON = pos.bn;
-            OB = pos.bb;
-            OR = pos.br;
-            OQ = pos.bq;
-            OK = pos.bk;
-        } else {
-            SP = pos.bp;
-            SN = pos.bn;
-            SB = pos.bb;
-            SR = pos.br;
-            SQ = pos.bq;
-            SK = pos.bk;
-            OP = pos.wp;
-            ON = pos.wn;
-            OB = pos.wb;
-            OR = pos.wr;
-            OQ = pos.wq;
-            OK = pos.wk;
-        }
-        const U64 SAME = SP | SN | SB | SR | SQ | SK;
-        const U64 OPPONENT = OP | ON | OB | OR | OQ | OK;
-        const U64 ALL = SAME | OPPONENT;
-
-        const Location k_pos = first_bit(SK);
-        const U64 checking_pieces = checkers(k_pos, OP, ON, OB, OR, OQ, OK, SAME, attacks, pos.turn);
-        const char num_checkers = popcnt(checking_pieces);
-
-        int movecnt = 0;
-        Move moves[MAX_MOVES];
-        if (num_checkers == 0) {
-            no_check_moves(moves, movecnt, pos, SP, SN, SB, SR, SQ, SK, OP, ON, OB, OR, OQ, OK, SAME, OPPONENT, ALL, k_pos, checking_pieces);
-        } else if (num_checkers == 1) {
-            single_check_moves(moves, movecnt, pos, SP, SN, SB, SR, SQ, SK, OP, ON, OB, OR, OQ, OK, SAME, OPPONENT, ALL, k_pos, checking_pieces);
+    template<Color Us>
+    bool is_legal(const Position& pos, const Move& move, const AttackInfo& info) {
+        constexpr Color Them = (Us == WHITE) ? BLACK : WHITE;
+        constexpr U64 k_safe = (Us == WHITE) ? CASTLING_WK : CASTLING_BK, q_safe = (Us == WHITE) ? CASTLING_WQ : CASTLING_BQ;
+        const U64 attacks = info.by_side[Them];
+        const char from = move.from(), to = move.to(), k = lsb(pos.bb[Us][KING]);
+        if (from == k) {
+            if (move.flags() == Move::KING_CASTLE) return !(k_safe & attacks);
+            if (move.flags() == Move::QUEEN_CASTLE) return !(q_safe & attacks);
+            return !bit(attacks, to);
         }
-        king_moves(moves, movecnt, k_pos, pos.castling, pos.turn, SAME, ALL, attacks);
-        return vector<Move>(moves, moves+movecnt);
+
+        MoveMasks masks;
+        move_masks<Us>(masks, pos, k);
+        if (masks.checkers & (masks.checkers-1)) return false;
+
+        if (move.is_ep()) return ep_legal<Us>(pos, k, from, masks);
+        if (!bit(masks.check_mask, to)) return false;
+        return !bit(masks.pinned, from) || bit(masks.pin_rays[(int)from], to);
+    }
+
+    bool is_legal(const Position& pos, const Move& move, const AttackInfo& info) {
+        /*
+        Checks that a pseudo legal move does not leave the king in check.
+        */
+        return pos.turn ? is_legal<WHITE>(pos, move, info) : is_legal<BLACK>(pos, move, info);
     }
 
 
     U64 get_white(const Position& pos) {
-        return pos.wk | pos.wp | pos.wn | pos.wb | pos.wr | pos.wq;
+        return pos.occupancy[WHITE];
     }
 
     U64 get_black(const Position& pos) {
-        return pos.bk | pos.bp | pos.bn | pos.bb | pos.br | pos.bq;
+        return pos.occupancy[BLACK];
     }
 
     U64 get_all(const Position& pos) {
-        return get_white(pos) | get_black(pos);
+        return pos.occupancy[WHITE] | pos.occupancy[BLACK];
     }
 
 
     Position startpos() {
+        const U64 start[2][6] = {
+            {START_BP, START_BN, START_BB, START_BR, START_BQ, START_BK},
+            {START_WP, START_WN, START_WB, START_WR, START_WQ, START_WK},
+        };
         Position pos;
-        pos.wp = START_WP;
-        pos.wn = START_WN;
-        pos.wb = START_WB;
-        pos.wr = START_WR;
-        pos.wq = START_WQ;
-        pos.wk = START_WK;
-        pos.bp = START_BP;
-        pos.bn = START_BN;
-        pos.bb = START_BB;
-        pos.br = START_BR;
-        pos.bq = START_BQ;
-        pos.bk = START_BK;
+        for (const bool color: {false, true}) {
+            for (UCH type = PAWN; type <= KING; type++) {
+                for (U64 pieces = start[color][type]; pieces;) put_piece(pos, make_piece(color, type), pop_lsb(pieces));
+            }
+        }
         pos.turn = true;
         pos.castling = 15;
         pos.ep = false;
         pos.draw50 = 0;
+        pos.hash = Hash::hash(pos);
+        pos.pawn_hash = Hash::pawn_hash(pos);
 
         return pos;
     }
 
-    Position push(Position pos, const Move& move) {
-        U64* pointers[12] = {&pos.wp, &pos.wn, &pos.wb, &pos.wr, &pos.wq, &pos.wk,
-            &pos.bp, &pos.bn, &pos.bb, &pos.br, &pos.bq, &pos.bk};
-        U64* to_board = pointers[0];
-        const bool is_king = bit(pos.wk|pos.bk, move.from);
-        const bool is_pawn = bit(pos.wp|pos.bp, move.from);
-
-        // Find to_board and set bits.
-        for (UCH i = 0; i < 12; i++) {
-            U64* p = pointers[i];
-            if (bit(*p, move.from)) {
-                to_board = p;
-                unset_bit(*p, move.from);
-            }
-            unset_bit(*p, move.to);
+    void push(Position& pos, const Move& move, Undo& undo) {
+        /*
+        Makes a move in place.
+        undo: Filled with what pop() needs to take the move back.
+        The hash is updated by xoring out the old state and xoring in the new.
+        */
+        const bool us = pos.turn;
+        const char from = move.from(), to = move.to();
+        undo.piece = pos.board[(int)from];
+        undo.captured = NO_PIECE;
+        undo.castling = pos.castling;
+        undo.ep = pos.ep;
+        undo.ep_square = pos.ep_square;
+        undo.draw50 = pos.draw50;
+        undo.hash = pos.hash;
+        undo.pawn_hash = pos.pawn_hash;
+
+        U64 hash = pos.hash ^ Hash::turn ^ Hash::castling[pos.castling];
+        if (Hash::ep_hashed(pos)) hash ^= Hash::ep_square[pos.ep_square];
+
+        if (move.is_capture() && !move.is_ep()) {
+            undo.captured = pos.board[(int)to];
+            remove_piece(pos, to);
+            hash ^= Hash::piece_bits[undo.captured][(int)to];
+            if (type_of(undo.captured) == PAWN) pos.pawn_hash ^= Hash::piece_bits[undo.captured][(int)to];
+        }
+        const UCH piece = move.is_promo() ? make_piece(us, KNIGHT+move.promo()) : undo.piece;
+        remove_piece(pos, from);
+        put_piece(pos, piece, to);
+        hash ^= Hash::piece_bits[undo.piece][(int)from] ^ Hash::piece_bits[piece][(int)to];
+        if (type_of(undo.piece) == PAWN) {
+            pos.pawn_hash ^= Hash::piece_bits[undo.piece][(int)from];
+            if (!move.is_promo()) pos.pawn_hash ^= Hash::piece_bits[piece][(int)to];
         }
 
         // 50 move rule
-        if (is_pawn || bit(get_all(pos), move.to)) pos.draw50 = 0;
+        if (type_of(undo.piece) == PAWN || move.is_capture()) pos.draw50 = 0;
         else pos.draw50++;
 
-        if (move.is_promo) {
-            if (pos.turn) {
-                switch (move.promo) {
-                    case 0: to_board = &pos.wn; break;
-                    case 1: to_board = &pos.wb; break;
-                    case 2: to_board = &pos.wr; break;
-                    case 3: to_board = &pos.wq; break;
-                }
-            } else {
-                switch (move.promo) {
-                    case 0: to_board = &pos.bn; break;
-                    case 1: to_board = &pos.bb; break;
-                    case 2: to_board = &pos.br; break;
-                    case 3: to_board = &pos.bq; break;
-                }
-            }
-        }
-        set_bit(*to_board, move.to);
-
         // Castling
-        if (is_king && (abs(move.to-move.from) == 2)) {
-            const char x = (move.to > move.from) ? 7 : 0;
-            const char new_x = (move.to > move.from) ? 5 : 3;
-            if (move.from < 8) {
-                unset_bit(*pointers[3], x);
-                set_bit(*pointers[3], new_x);
-            } else {
-                unset_bit(*pointers[9], x+56);
-                set_bit(*pointers[9], new_x+56);
-            }
-            if (pos.turn) {
+        if (move.is_castle()) {
+            const char rank = from & 56;
+            const char x = (move.flags() == Move::KING_CASTLE) ? 7 : 0;
+            const char new_x = (move.flags() == Move::KING_CASTLE) ? 5 : 3;
+            const UCH rook = make_piece(us, ROOK);
+            remove_piece(pos, x+rank);
+            put_piece(pos, rook, new_x+rank);
+            hash ^= Hash::piece_bits[rook][x+rank] ^ Hash::piece_bits[rook][new_x+rank];
+            if (us) {
                 unset_bit(pos.castling, 0);
                 unset_bit(pos.castling, 1);
             } else {
@@ -1136,7 +1025,7 @@ namespace Bitboard {
                 unset_bit(pos.castling, 3);
             }
         } else {
-            switch (move.from) {
+            switch (from) {
                 case  0: unset_bit(pos.castling, 1);                             break;
                 case  4: unset_bit(pos.castling, 0); unset_bit(pos.castling, 1); break;
                 case  7: unset_bit(pos.castling, 0);                             break;
@@ -1144,7 +1033,7 @@ namespace Bitboard {
                 case 60: unset_bit(pos.castling, 2); unset_bit(pos.castling, 3); break;
                 case 63: unset_bit(pos.castling, 2);                             break;
             }
-            switch (move.to) {
+            switch (to) {
                 case  0: unset_bit(pos.castling, 1); break;
                 case  7: unset_bit(pos.castling, 0); break;
                 case 56: unset_bit(pos.castling, 3); break;
@@ -1152,33 +1041,69 @@ namespace Bitboard {
             }
         }
 
+        hash ^= Hash::castling[pos.castling];
+
         // En passant
-        const bool ep = pos.ep;
         pos.ep = false;
-        if (is_pawn) {
-            if (move.to > move.from) {
-                if ((move.to-move.from) == 16) {
-                    pos.ep = true;
-                    pos.ep_square = move.from + 8;
-                } else if (ep && move.to == pos.ep_square) {
-                    unset_bit(pos.bp, move.to-8);
-                }
-            } else {
-                if ((move.from-move.to) == 16) {
-                    pos.ep = true;
-                    pos.ep_square = move.from - 8;
-                } else if (ep && move.to == pos.ep_square) {
-                    unset_bit(pos.wp, move.to+8);
-                }
-            }
+        if (move.flags() == Move::DOUBLE_PUSH) {
+            pos.ep = true;
+            pos.ep_square = (from+to) / 2;
+        } else if (move.is_ep()) {
+            const char captured = us ? to-8 : to+8;
+            remove_piece(pos, captured);
+            hash ^= Hash::piece_bits[make_piece(!us, PAWN)][(int)captured];
+            pos.pawn_hash ^= Hash::piece_bits[make_piece(!us, PAWN)][(int)captured];
         }
 
         pos.turn = !pos.turn;
         pos.move_cnt++;
-        return pos;
+        if (Hash::ep_hashed(pos)) hash ^= Hash::ep_square[pos.ep_square];
+        pos.hash = hash;
+
+        #if DEBUG_MODE
+            if (pos.hash != Hash::hash(pos)) cout << "info string Hash mismatch after " << move_str(move) << endl;
+            if (pos.pawn_hash != Hash::pawn_hash(pos)) cout << "info string Pawn hash mismatch after " << move_str(move) << endl;
+        #endif
+    }
+
+    void pop(Position& pos, const Move& move, const Undo& undo) {
+        // Takes back a move made with push().
+        pos.turn = !pos.turn;
+        pos.move_cnt--;
+        const bool us = pos.turn;
+        const char from = move.from(), to = move.to();
+
+        remove_piece(pos, to);
+        put_piece(pos, undo.piece, from);
+        if (undo.captured != NO_PIECE) put_piece(pos, undo.captured, to);
+
+        if (move.is_castle()) {
+            const char rank = from & 56;
+            const char x = (move.flags() == Move::KING_CASTLE) ? 7 : 0;
+            const char new_x = (move.flags() == Move::KING_CASTLE) ? 5 : 3;
+            remove_piece(pos, new_x+rank);
+            put_piece(pos, make_piece(us, ROOK), x+rank);
+        } else if (move.is_ep()) {
+            put_piece(pos, make_piece(!us, PAWN), us ? to-8 : to+8);
+        }
+
+        pos.castling = undo.castling;
+        pos.ep = undo.ep;
+        pos.ep_square = undo.ep_square;
+        pos.draw50 = undo.draw50;
+        pos.hash = undo.hash;
+        pos.pawn_hash = undo.pawn_hash;
+    }
+
+    Position push(const Position& pos, const Move& move) {
+        // Copies once into the returned position, Position is too large to pass by value.
+        Position child = pos;
+        Undo undo;
+        push(child, move, undo);
+        return child;
     }
 
-    Position push(Position pos, const string& uci) {
-        return push(pos, parse_uci(uci));
+    Position push(const Position& pos, const string& uci) {
+        return push(pos, parse_uci(pos, uci));
     }
 }
@@ -22,6 +22,23 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <array>
+
+#if defined(__BMI2__) || defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+
+#if defined(__BMI2__)
+    #define USE_PEXT  1
+#else
+    #define USE_PEXT  0
+#endif
+
+#if defined(__AVX2__)
+    #define USE_AVX2  1
+#else
+    #define USE_AVX2  0
+#endif
 
 using std::cin;
 using std::cout;
@@ -30,36 +47,104 @@ using std::vector;
 using std::string;
 
 typedef unsigned long long  U64;
+typedef unsigned short      U16;
 typedef unsigned char       UCH;
 
 struct Move {
-    Move();
-    Move(const char, const char, const bool=false, const char=0);
-    bool operator==(const Move &rhs) const;
-
-    UCH from;
-    UCH to;
-    UCH promo;  // 0, 1, 2, 3
-    bool is_promo;
+    /*
+    Packed into 16 bits: from square (bits 0-5), to square (bits 6-11) and flags (bits 12-15).
+    Promotion moves store the promotion piece (0 knight .. 3 queen) in the low two flag bits.
+    */
+    static constexpr UCH QUIET = 0, DOUBLE_PUSH = 1, KING_CASTLE = 2, QUEEN_CASTLE = 3, CAPTURE = 4, EP_CAPTURE = 5,
+        PROMO = 8;
+
+    Move() = default;
+    constexpr Move(const char from, const char to, const UCH flags=QUIET)
+        : data((U16)(from | (to<<6) | (flags<<12))) {}
+    bool operator==(const Move &rhs) const {return data == rhs.data;}
+    bool operator!=(const Move &rhs) const {return data != rhs.data;}
+
+    UCH from() const {return data & 63;}
+    UCH to() const {return (data>>6) & 63;}
+    UCH flags() const {return data>>12;}
+    UCH promo() const {return (data>>12) & 3;}  // 0, 1, 2, 3
+    bool is_promo() const {return data & (PROMO<<12);}
+    bool is_capture() const {return data & (CAPTURE<<12);}
+    bool is_ep() const {return flags() == EP_CAPTURE;}
+    bool is_castle() const {return flags() == KING_CASTLE || flags() == QUEEN_CASTLE;}
+
+    U16 data;
 };
 
 
-struct Position {
+enum Color {BLACK, WHITE};  // Same values as Position::turn.
+enum PieceType {PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING};
+
+struct alignas(64) Position {
+    /*
+    Pieces are kept both as bitboards and as a mailbox, updated together by
+    Bitboard::put_piece and Bitboard::remove_piece.
+    The Zobrist key is updated by Bitboard::push, positions built piece by piece
+    set it with Hash::hash once done.
+    */
     Position();
-    Position(const U64, const U64, const U64, const U64, const U64, const U64, const U64, const U64, const U64,
-        const U64, const U64, const U64, const bool, const char, const bool, const char);
     bool operator==(const Position &rhs) const;
 
-    U64 wp, wn, wb, wr, wq, wk, bp, bn, bb, br, bq, bk;
+    U64 bb[2][6];      // Indexed by color, then piece type.
+    U64 occupancy[2];  // All pieces of each color.
+    UCH board[64];     // Piece on each square (color*6 + type), Bitboard::NO_PIECE if empty.
+    U64 hash;
+    U64 pawn_hash;     // Zobrist key of the pawns only.
     bool turn;
     UCH castling;
     UCH ep_square;
     bool ep;
-
-    Position* parent;
-    float eval;
+    UCH draw50;
     int move_cnt;
+};
+
+struct MoveList;
+
+struct Magic {
+    U64 mask;
+    U64 magic;
+    U64* attacks;
+    UCH shift;
+};
+
+struct AttackInfo {
+    /*
+    Attack maps of a node, computed once by Bitboard::attack_info and shared by move generation and eval.
+    Indexed by side, true for white. Slider attacks see through the enemy king so that
+    squares behind a checked king still count as attacked.
+    */
+    U64 by_side[2];
+    U64 by_piece[2][6];  // Indexed by side, then piece type.
+    U64 occupancy[2];
+    U64 all;
+    U64 king_zone[2];    // King square and the squares around it.
+};
+
+struct MoveMasks {
+    /*
+    Legality masks of the side to move, computed once per node by Bitboard::move_masks.
+    */
+    U64 checkers;
+    U64 check_mask;    // Squares that capture or block a single check, FULL if not in check.
+    U64 pinned;        // Own pieces pinned to the king.
+    U64 pin_rays[64];  // Ray from the king to the pinner, inclusive, only set for pinned squares.
+};
+
+struct Undo {
+    // State push() cannot recover on its own, restored by pop().
+    UCH piece;     // Moving piece, color*6 + type
+    UCH captured;  // Captured piece, Bitboard::NO_PIECE if none
+    UCH castling;
+    UCH ep_square;
+    bool ep;
     UCH draw50;
+    U64 hash;
+    U64 pawn_hash;
 };
 
 struct Location {
@@ -115,6 +200,12 @@ namespace Bitboard {
     constexpr U64 RANKS[8] = {RANK1, RANK2, RANK3, RANK4, RANK5, RANK6, RANK7, RANK8};
     constexpr U64 FILES[8] = {FILE1, FILE2, FILE3, FILE4, FILE5, FILE6, FILE7, FILE8};
 
+    constexpr UCH NO_PIECE = 12;
+    constexpr char PIECE_SYMBOLS[] = "pnbrqkPNBRQK";  // Indexed by piece, color*6 + type.
+
+    // Move generation stages, captures include promotions and en passant.
+    enum GenType {GEN_ALL, GEN_CAPTURES, GEN_QUIETS};
+
     constexpr U64 BYTE_ALL_ONE = 255ULL;
     constexpr int MAX_MOVES = 220;
     constexpr int MAX_HASH_MOVES = 30;
@@ -130,16 +221,186 @@ namespace Bitboard {
     constexpr char DIR_Q[DIR_Q_SIZE][2] = {{1, 1}, {-1, 1}, {1, -1}, {-1, -1}, {0, 1}, {-1, 0}, {1, 0}, {0, -1}};
     constexpr char DIR_K[DIR_K_SIZE][2] = {{-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1}};
 
-    bool bit(const U64&, const char&);
-    bool bit(const UCH&, const char&);
-    char popcnt(const U64&);
-    void set_bit(U64&, const char&);
-    void unset_bit(U64&, const char&);
-    void set_bit(UCH&, const char&);
-    void unset_bit(UCH&, const char&);
-    bool in_board(const char&, const char&);
-    char first_bit_char(const U64&);
-    Location first_bit(const U64&);
+    constexpr bool bit(const U64& board, const char& pos) {
+        return ((1ULL << pos) & board) != 0;
+    }
+
+    constexpr bool bit(const UCH& board, const char& pos) {
+        return ((1ULL << pos) & board) != 0;
+    }
+
+    constexpr void set_bit(U64& board, const char& pos) {
+        board |= (1ULL << pos);
+    }
+
+    constexpr void unset_bit(U64& board, const char& pos) {
+        board &= ~(1ULL << pos);
+    }
+
+    constexpr void set_bit(UCH& board, const char& pos) {
+        board |= (1ULL << pos);
+    }
+
+    constexpr void unset_bit(UCH& board, const char& pos) {
+        board &= ~(1ULL << pos);
+    }
+
+    constexpr bool in_board(const char& x, const char& y) {
+        return (0 <= x && x < 8 && 0 <= y && y < 8);
+    }
+
+    constexpr char popcnt(const U64& num) {
+        #if defined(__GNUC__)
+            return __builtin_popcountll(num);  // popcnt instruction when built with -mpopcnt.
+        #else
+            U64 x = num - ((num>>1) & 0x5555555555555555ULL);
+            x = (x & 0x3333333333333333ULL) + ((x>>2) & 0x3333333333333333ULL);
+            x = (x + (x>>4)) & 0x0F0F0F0F0F0F0F0FULL;
+            return (x * 0x0101010101010101ULL) >> 56;
+        #endif
+    }
+
+    constexpr char DEBRUIJN_IDX[64] = {
+         0, 47,  1, 56, 48, 27,  2, 60, 57, 49, 41, 37, 28, 16,  3, 61,
+        54, 58, 35, 52, 50, 42, 21, 44, 38, 32, 29, 23, 17, 11,  4, 62,
+        46, 55, 26, 59, 40, 36, 15, 53, 34, 51, 20, 43, 31, 22, 10, 45,
+        25, 39, 14, 33, 19, 30,  9, 24, 13, 18,  8, 12,  7,  6,  5, 63,
+    };
+
+    constexpr char lsb(const U64& board) {
+        // Index of least significant bit, board must not be empty.
+        #if defined(__GNUC__)
+            return __builtin_ctzll(board);  // tzcnt/bsf
+        #else
+            return DEBRUIJN_IDX[((board ^ (board-1)) * 0x03F79D71B4CB0A89ULL) >> 58];
+        #endif
+    }
+
+    constexpr char msb(const U64& board) {
+        // Index of most significant bit, board must not be empty.
+        #if defined(__GNUC__)
+            return 63 ^ __builtin_clzll(board);  // lzcnt/bsr
+        #else
+            U64 x = board;
+            x |= x >> 1;
+            x |= x >> 2;
+            x |= x >> 4;
+            x |= x >> 8;
+            x |= x >> 16;
+            x |= x >> 32;
+            return DEBRUIJN_IDX[(x * 0x03F79D71B4CB0A89ULL) >> 58];
+        #endif
+    }
+
+    constexpr char pop_lsb(U64& board) {
+        // Returns index of least significant bit and clears it.
+        const char sq = lsb(board);
+        board &= board - 1;
+        return sq;
+    }
+
+    constexpr char first_bit_char(const U64& board) {
+        // Index of lowest set bit, 0 if board is empty.
+        return (board == 0) ? 0 : lsb(board);
+    }
+
+    inline Location first_bit(const U64& board) {
+        return Location(first_bit_char(board));
+    }
+
+    constexpr std::array<U64, 64> leaper_table(const char (&dirs)[8][2]) {
+        // Attacks of a knight or king from every square.
+        std::array<U64, 64> table = {};
+        for (char sq = 0; sq < 64; sq++) {
+            for (const auto& dir: dirs) {
+                const char x = (sq&7) + dir[0], y = (sq>>3) + dir[1];
+                if (0 <= x && x < 8 && 0 <= y && y < 8) table[sq] |= 1ULL << ((y<<3) + x);
+            }
+        }
+        return table;
+    }
+
+    constexpr U64 pawn_attacks(const U64& pawns, const bool& side) {
+        // Set-wise pawn captures, side: true if white else false.
+        if (side) return ((pawns << 7) & ~FILE8) | ((pawns << 9) & ~FILE1);
+        else      return ((pawns >> 9) & ~FILE8) | ((pawns >> 7) & ~FILE1);
+    }
+
+    constexpr U64 knight_attacks(const U64& knights) {
+        // Set-wise knight attacks.
+        const U64 l1 = (knights >> 1) & ~FILE8, l2 = (knights >> 2) & ~(FILE7|FILE8);
+        const U64 r1 = (knights << 1) & ~FILE1, r2 = (knights << 2) & ~(FILE1|FILE2);
+        const U64 h1 = l1 | r1, h2 = l2 | r2;
+        return (h1 << 16) | (h1 >> 16) | (h2 << 8) | (h2 >> 8);
+    }
+
+    constexpr std::array<U64, 64> pawn_table(const bool& side) {
+        std::array<U64, 64> table = {};
+        for (char sq = 0; sq < 64; sq++) table[sq] = pawn_attacks(1ULL << sq, side);
+        return table;
+    }
+
+    constexpr std::array<U64, 64> KNIGHT_ATTACKS = leaper_table(DIR_N);
+    constexpr std::array<U64, 64> KING_ATTACKS = leaper_table(DIR_K);
+    constexpr std::array<U64, 64> PAWN_ATTACKS[2] = {pawn_table(false), pawn_table(true)};  // Indexed by side.
+
+    extern Magic ROOK_MAGICS[64];
+    extern Magic BISHOP_MAGICS[64];
+    extern U64 BETWEEN[64][64];
+
+    void init();
+
+    inline U64 rook_attacks(const char& sq, const U64& occupied) {
+        // Squares attacked by a rook on sq, with occupied as blockers.
+        const Magic& m = ROOK_MAGICS[(int)sq];
+        #if USE_PEXT
+            return m.attacks[_pext_u64(occupied, m.mask)];
+        #else
+            return m.attacks[((occupied & m.mask) * m.magic) >> m.shift];
+        #endif
+    }
+
+    inline U64 bishop_attacks(const char& sq, const U64& occupied) {
+        const Magic& m = BISHOP_MAGICS[(int)sq];
+        #if USE_PEXT
+            return m.attacks[_pext_u64(occupied, m.mask)];
+        #else
+            return m.attacks[((occupied & m.mask) * m.magic) >> m.shift];
+        #endif
+    }
+
+    inline U64 queen_attacks(const char& sq, const U64& occupied) {
+        return rook_attacks(sq, occupied) | bishop_attacks(sq, occupied);
+    }
+
+    constexpr UCH make_piece(const bool& color, const UCH& type) {
+        return color*6 + type;
+    }
+
+    constexpr UCH type_of(const UCH& piece) {
+        return piece % 6;
+    }
+
+    constexpr bool color_of(const UCH& piece) {
+        return piece >= 6;
+    }
+
+    inline void put_piece(Position& pos, const UCH& piece, const char& sq) {
+        // Places a piece on an empty square.
+        const U64 mask = 1ULL << sq;
+        pos.bb[color_of(piece)][type_of(piece)] |= mask;
+        pos.occupancy[color_of(piece)] |= mask;
+        pos.board[(int)sq] = piece;
+    }
+
+    inline void remove_piece(Position& pos, const char& sq) {
+        // Removes the piece on an occupied square.
+        const UCH piece = pos.board[(int)sq];
+        const U64 mask = 1ULL << sq;
+        pos.bb[color_of(piece)][type_of(piece)] ^= mask;
+        pos.occupancy[color_of(piece)] ^= mask;
+        pos.board[(int)sq] = NO_PIECE;
+    }
 
     string piece_at(const Position&, const char&);
     U64 color(const Position&, const bool&);
@@ -149,27 +410,59 @@ namespace Bitboard {
     string move_str(const Move&);
     string fen(const Position&);
     Position parse_fen(const string&);
-    Move parse_uci(const string&);
+    Move parse_uci(const Position&, const string&);
 
-    U64 attacked(const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const bool&);
+    // Templated on the side to move, the untemplated overloads dispatch once on pos.turn.
+    template<Color Us> U64 attacked(const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const U64&);
+    template<Color Us> U64 attacked(const Position&);
     U64 attacked(const Position&, const bool&);
+    U64 slider_fill(const U64&, const U64&, const U64&);
+    template<Color Us> U64 attacked_setwise(const Position&);
+    U64 attacked_setwise(const Position&, const bool&);
+    template<Color Us> void attack_info(const Position&, AttackInfo&);
+    void attack_info(const Position&, AttackInfo&);
     char num_attacks(const vector<Move>&, const Location&);
-    U64 pinned(const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const U64&);
-    U64 checkers(const Location&, const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const bool&);
-    void king_moves(Move*, int&, const Location&, const UCH&, const bool&, const U64&, const U64&, const U64&);
-    void single_check_moves(Move*, int&, const Position&, const U64&, const U64&, const U64&, const U64&,
-        const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const U64&,
-        const U64&, const U64&, const U64&, const Location&, const U64&);
-    void no_check_moves(Move*, int&, const Position&, const U64&, const U64&, const U64&, const U64&,
-        const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const U64&, const U64&,
-        const U64&, const U64&, const U64&, const Location&, const U64&);
-    vector<Move> legal_moves(Position, const U64&);
+    template<Color Us> void move_masks(MoveMasks&, const Position&, const char&);
+    template<Color Us> bool ep_legal(const Position&, const char&, const char&, const MoveMasks&);
+    U64 gen_mask(const GenType&, const U64&);
+    void add_moves(Move*, int&, const char&, const U64&, const U64&);
+    template<Color Us> U64 castle_targets(const UCH&, const U64&, const U64&);
+    template<Color Us> void king_moves(Move*, int&, const char&, const UCH&, const U64&, const U64&, const U64&, const GenType&);
+    template<Color Us> void piece_moves(Move*, int&, const Position&, const char&, const MoveMasks&, const GenType&);
+    template<Color Us> void legal_moves(const Position&, const AttackInfo&, MoveList&, const GenType&);
+    void legal_moves(const Position&, const AttackInfo&, MoveList&, const GenType& = GEN_ALL);
+    template<Color Us> int count_moves(const Position&, const AttackInfo&);
+    int count_moves(const Position&, const AttackInfo&);
+    bool is_pseudo_legal(const Position&, const Move&);
+    template<Color Us> bool is_legal(const Position&, const Move&, const AttackInfo&);
+    bool is_legal(const Position&, const Move&, const AttackInfo&);
 
     U64 get_white(const Position&);
     U64 get_black(const Position&);
     U64 get_all(const Position&);
 
     Position startpos();
-    Position push(Position, const Move&);
-    Position push(Position, const string&);
+    void push(Position&, const Move&, Undo&);
+    void pop(Position&, const Move&, const Undo&);
+    Position push(const Position&, const Move&);
+    Position push(const Position&, const string&);
 }
+
+struct MoveList {
+    /*
+    Fixed capacity move list filled by Bitboard::legal_moves.
+    Lives on the caller's stack, so move generation never allocates.
+    */
+    MoveList();
+    Move* begin();
+    Move* end();
+    const Move* begin() const;
+    const Move* end() const;
+    Move& operator[](const int&);
+    const Move& operator[](const int&) const;
+    int size() const;
+    bool empty() const;
+
+    Move moves[Bitboard::MAX_MOVES];
+    int count;
+};
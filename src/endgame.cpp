@@ -40,16 +40,16 @@ namespace Endgame {
     }
 
     vector<char> get_cnts(const Position& pos) {
-        const char wpc = Bitboard::popcnt(pos.wp);
-        const char wnc = Bitboard::popcnt(pos.wn);
-        const char wbc = Bitboard::popcnt(pos.wb);
-        const char wrc = Bitboard::popcnt(pos.wr);
-        const char wqc = Bitboard::popcnt(pos.wq);
-        const char bpc = Bitboard::popcnt(pos.bp);
-        const char bnc = Bitboard::popcnt(pos.bn);
-        const char bbc = Bitboard::popcnt(pos.bb);
-        const char brc = Bitboard::popcnt(pos.br);
-        const char bqc = Bitboard::popcnt(pos.bq);
+        const char wpc = Bitboard::popcnt(pos.bb[WHITE][PAWN]);
+        const char wnc = Bitboard::popcnt(pos.bb[WHITE][KNIGHT]);
+        const char wbc = Bitboard::popcnt(pos.bb[WHITE][BISHOP]);
+        const char wrc = Bitboard::popcnt(pos.bb[WHITE][ROOK]);
+        const char wqc = Bitboard::popcnt(pos.bb[WHITE][QUEEN]);
+        const char bpc = Bitboard::popcnt(pos.bb[BLACK][PAWN]);
+        const char bnc = Bitboard::popcnt(pos.bb[BLACK][KNIGHT]);
+        const char bbc = Bitboard::popcnt(pos.bb[BLACK][BISHOP]);
+        const char brc = Bitboard::popcnt(pos.bb[BLACK][ROOK]);
+        const char bqc = Bitboard::popcnt(pos.bb[BLACK][QUEEN]);
         return {wpc, wnc, wbc, wrc, wqc, bpc, bnc, bbc, brc, bqc};
     }
 
@@ -66,22 +66,22 @@ namespace Endgame {
     }
 
 
-    Move bestmove(const Position& pos, const vector<Move>& moves, const int& eg) {
+    Move bestmove(const Position& pos, const MoveList& moves, const int& eg) {
         const vector<char> counts = get_cnts(pos);
         if (pos.turn) {
             switch (eg) {
-                case 1: return kqvk(moves, pos, pos.wk, pos.wq, pos.bk);
+                case 1: return kqvk(moves, pos, pos.bb[WHITE][KING], pos.bb[WHITE][QUEEN], pos.bb[BLACK][KING]);
             }
         } else {
             switch (eg) {
-                case 1: return kqvk(moves, pos, pos.bk, pos.bq, pos.wk);
+                case 1: return kqvk(moves, pos, pos.bb[BLACK][KING], pos.bb[BLACK][QUEEN], pos.bb[WHITE][KING]);
             }
         }
         return Move();
     }
 
 
-    Move kqvk(const vector<Move>& moves, const Position& pos, const U64& _ck, const U64& _cq, const U64& _ok) {
+    Move kqvk(const MoveList& moves, const Position& pos, const U64& _ck, const U64& _cq, const U64& _ok) {
         const Location ck = Bitboard::first_bit(_ck);
         const Location cq = Bitboard::first_bit(_cq);
         const Location ok = Bitboard::first_bit(_ok);
@@ -113,16 +113,16 @@ namespace Endgame {
 
                 if (k_target_pos == ckp) {  // Do checkmating move
                     for (const auto& move: moves) {
-                        const char ok_diff = abs(okp-move.to);
-                        const char ck_diff = abs(ckp-move.to);
+                        const char ok_diff = abs(okp-move.to());
+                        const char ck_diff = abs(ckp-move.to());
                         if ((ok_diff==9 || ok_diff==7) && (ck_diff==9 || ck_diff==7)) return move;
                     }
                 } else {  // Move king closer
                     char closest = 16;
                     Move best_move = moves[0];
                     for (const auto& move: moves) {
-                        if (move.from == ckp) {
-                            const Location to(move.to);
+                        if (move.from() == ckp) {
+                            const Location to(move.to());
                             const char delta = abs(k_target.x-to.x) + abs(k_target.y-to.y);
                             if (delta < closest) {
                                 closest = delta;
@@ -139,14 +139,17 @@ namespace Endgame {
         char least_move_dist = 16;
         Move best_move = moves[0];
         for (const auto& move: moves) {
-            if (move.from == cqp) {
+            if (move.from() == cqp) {
                 const Position new_pos = Bitboard::push(pos, move);
-                const vector<Move> new_moves = Bitboard::legal_moves(new_pos, Bitboard::attacked(new_pos, !new_pos.turn));
-                if (new_moves.size() == 0) {
+                MoveList new_moves;
+                AttackInfo info;
+                Bitboard::attack_info(new_pos, info);
+                Bitboard::legal_moves(new_pos, info, new_moves);
+                if (new_moves.empty()) {
                     continue;  // Continue if move results in stalemate.
                 }
 
-                const Location to(move.to);
+                const Location to(move.to());
                 const char dx = abs(to.x-ok.x);
                 const char dy = abs(to.y-ok.y);
                 if ((dx==0 || dx==1) && (dy==0 || dy==1)) continue;  // If move goes to opponent's king
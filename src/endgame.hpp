@@ -39,7 +39,7 @@ namespace Endgame {
     vector<char> get_cnts(const Position&);
     int eg_type(const Position&);
 
-    Move bestmove(const Position&, const vector<Move>&, const int&);
+    Move bestmove(const Position&, const MoveList&, const int&);
 
-    Move kqvk(const vector<Move>&, const Position&, const U64&, const U64&, const U64&);
+    Move kqvk(const MoveList&, const Position&, const U64&, const U64&, const U64&);
 }
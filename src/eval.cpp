@@ -20,6 +20,7 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <algorithm>
 #include "bitboard.hpp"
 #include "options.hpp"
 #include "eval.hpp"
@@ -35,6 +36,31 @@ using Bitboard::popcnt;
 using Bitboard::bit;
 
 
+PawnTable::PawnTable(const int& mb) {
+    size = std::max((U64)mb * 1048576 / sizeof(PawnEntry), (U64)1);
+    entries = new PawnEntry[size]();
+}
+
+PawnTable::~PawnTable() {
+    delete[] entries;
+}
+
+bool PawnTable::probe(const U64& key, float& structure, float& space) {
+    const PawnEntry& entry = entries[key % size];
+    if (entry.key != key) return false;
+    structure = entry.structure;
+    space = entry.space;
+    return true;
+}
+
+void PawnTable::store(const U64& key, const float& structure, const float& space) {
+    PawnEntry& entry = entries[key % size];
+    entry.key = key;
+    entry.structure = structure;
+    entry.space = space;
+}
+
+
 namespace Eval {
     UCH CENTER_DIST_MAP[64];
     const UCH FILE_DIST_MAP[8] = {3, 2, 1, 0, 0, 1, 2, 3};
@@ -64,44 +90,44 @@ namespace Eval {
 
     float material(const Position& pos) {
         float value = 0;
-        value += popcnt(pos.wp) * 1;
-        value += popcnt(pos.wn) * 3;
-        value += popcnt(pos.wb) * 3;
-        value += popcnt(pos.wr) * 5;
-        value += popcnt(pos.wq) * 9;
-        value -= popcnt(pos.bp) * 1;
-        value -= popcnt(pos.bn) * 3;
-        value -= popcnt(pos.bb) * 3;
-        value -= popcnt(pos.br) * 5;
-        value -= popcnt(pos.bq) * 9;
+        value += popcnt(pos.bb[WHITE][PAWN]) * 1;
+        value += popcnt(pos.bb[WHITE][KNIGHT]) * 3;
+        value += popcnt(pos.bb[WHITE][BISHOP]) * 3;
+        value += popcnt(pos.bb[WHITE][ROOK]) * 5;
+        value += popcnt(pos.bb[WHITE][QUEEN]) * 9;
+        value -= popcnt(pos.bb[BLACK][PAWN]) * 1;
+        value -= popcnt(pos.bb[BLACK][KNIGHT]) * 3;
+        value -= popcnt(pos.bb[BLACK][BISHOP]) * 3;
+        value -= popcnt(pos.bb[BLACK][ROOK]) * 5;
+        value -= popcnt(pos.bb[BLACK][QUEEN]) * 9;
         return value;
     }
 
     float total_mat(const Position& pos) {
         float value = 0;
-        value += popcnt(pos.wp) * 1;
-        value += popcnt(pos.wn) * 3;
-        value += popcnt(pos.wb) * 3;
-        value += popcnt(pos.wr) * 5;
-        value += popcnt(pos.wq) * 9;
-        value += popcnt(pos.bp) * 1;
-        value += popcnt(pos.bn) * 3;
-        value += popcnt(pos.bb) * 3;
-        value += popcnt(pos.br) * 5;
-        value += popcnt(pos.bq) * 9;
+        value += popcnt(pos.bb[WHITE][PAWN]) * 1;
+        value += popcnt(pos.bb[WHITE][KNIGHT]) * 3;
+        value += popcnt(pos.bb[WHITE][BISHOP]) * 3;
+        value += popcnt(pos.bb[WHITE][ROOK]) * 5;
+        value += popcnt(pos.bb[WHITE][QUEEN]) * 9;
+        value += popcnt(pos.bb[BLACK][PAWN]) * 1;
+        value += popcnt(pos.bb[BLACK][KNIGHT]) * 3;
+        value += popcnt(pos.bb[BLACK][BISHOP]) * 3;
+        value += popcnt(pos.bb[BLACK][ROOK]) * 5;
+        value += popcnt(pos.bb[BLACK][QUEEN]) * 9;
         return value;
     }
 
     float non_pawn_mat(const Position& pos) {
         float value = 0;
-        value += popcnt(pos.wn) * 3;
-        value += popcnt(pos.wb) * 3;
-        value += popcnt(pos.wr) * 5;
-        value += popcnt(pos.wq) * 9;
-        value += popcnt(pos.bn) * 3;
-        value += popcnt(pos.bb) * 3;
-        value += popcnt(pos.br) * 5;
-        value += popcnt(pos.bq) * 9;
+        value += popcnt(pos.bb[WHITE][KNIGHT]) * 3;
+        value += popcnt(pos.bb[WHITE][BISHOP]) * 3;
+        value += popcnt(pos.bb[WHITE][ROOK]) * 5;
+        value += popcnt(pos.bb[WHITE][QUEEN]) * 9;
+        value += popcnt(pos.bb[BLACK][KNIGHT]) * 3;
+        value += popcnt(pos.bb[BLACK][BISHOP]) * 3;
+        value += popcnt(pos.bb[BLACK][ROOK]) * 5;
+        value += popcnt(pos.bb[BLACK][QUEEN]) * 9;
         return value;
     }
 
@@ -247,11 +273,11 @@ namespace Eval {
         );
     }
 
-    float pawn_attacks(const Position& pos) {
-        const U64 w_attacks = Bitboard::attacked(pos.wp, 0, 0, 0, 0, 0, 0, true);
-        const U64 b_attacks = Bitboard::attacked(pos.bp, 0, 0, 0, 0, 0, 0, false);
-        const U64 white = Bitboard::get_white(pos) ^ pos.wp;
-        const U64 black = Bitboard::get_black(pos) ^ pos.bp;
+    float pawn_attacks(const Position& pos, const AttackInfo& info) {
+        const U64 w_attacks = info.by_piece[true][PAWN];
+        const U64 b_attacks = info.by_piece[false][PAWN];
+        const U64 white = info.occupancy[true] ^ pos.bb[WHITE][PAWN];
+        const U64 black = info.occupancy[false] ^ pos.bb[BLACK][PAWN];
         const char w_cnt = popcnt(w_attacks & black);
         const char b_cnt = popcnt(b_attacks & white);
 
@@ -302,9 +328,9 @@ namespace Eval {
         return score;
     }
 
-    float queens(const Position& pos) {
-        const UCH wq = Bitboard::first_bit(pos.wq).loc, bq = Bitboard::first_bit(pos.bq).loc;
-        const U64 white = Bitboard::get_white(pos), black = Bitboard::get_black(pos);
+    float queens(const Position& pos, const AttackInfo& info) {
+        const UCH wq = Bitboard::first_bit(pos.bb[WHITE][QUEEN]).loc, bq = Bitboard::first_bit(pos.bb[BLACK][QUEEN]).loc;
+        const U64 white = info.occupancy[true], black = info.occupancy[false];
 
         float score = 0;
         score += (float)(6-CENTER_DIST_MAP[wq]) / 15;
@@ -323,12 +349,14 @@ namespace Eval {
     }
 
 
-    float eval(const Options& options, const Position& pos, const vector<Move>& moves, const int& depth, const U64& o_attacks,
-            const bool print) {
+    float eval(const Options& options, const Position& pos, const MoveList& moves, const int& depth, const AttackInfo& info,
+            PawnTable* const pawns, const bool print) {
+        /*
+        Static evaluation, white relative.
+        pawns: Optional cache of the pawn terms, which only depend on pos.pawn_hash.
+        */
         if (moves.empty()) {
-            bool checked = false;
-            if      ( pos.turn && ((o_attacks & pos.wk) != 0)) checked = true;
-            else if (!pos.turn && ((o_attacks & pos.bk) != 0)) checked = true;
+            const bool checked = (info.by_side[!pos.turn] & pos.bb[pos.turn][KING]) != 0;
             if (checked) {
                 // Increment value by depth to encourage sooner mate.
                 // The larger depth is, the closer it is to the leaf nodes.
@@ -339,14 +367,23 @@ namespace Eval {
         }
         if (pos.draw50 >= 100) return 0;
 
-        const float mat         =                          material(pos)                           / 1.F;
-        const float sp          = options.EvalSpace      * space(pos.wp, pos.bp)                   / 5.F;
-        const float pawn_struct = options.EvalPawnStruct * pawn_structure(pos.wp, pos.bp)          / 5.F;
-        const float p_attacks   =                          pawn_attacks(pos)                       / 2.F;
-        const float knight      = options.EvalKnights    * knights(pos.wn, pos.bn, pos.wp, pos.bp) / 16.F;
-        const float rook        = options.EvalRooks      * rooks(pos.wr, pos.br, pos.wp, pos.bp)   / 2.F;
-        const float queen       = options.EvalQueens     * queens(pos)                             / 6.F;
-        const float king        = options.EvalKings      * kings(pos.wk, pos.bk)                   / 16.F;
+        const U64* const white = pos.bb[WHITE];
+        const U64* const black = pos.bb[BLACK];
+        float pawn_terms[2];
+        if (pawns == nullptr || !pawns->probe(pos.pawn_hash, pawn_terms[0], pawn_terms[1])) {
+            pawn_terms[0] = pawn_structure(white[PAWN], black[PAWN]);
+            pawn_terms[1] = space(white[PAWN], black[PAWN]);
+            if (pawns != nullptr) pawns->store(pos.pawn_hash, pawn_terms[0], pawn_terms[1]);
+        }
+
+        const float mat         =                          material(pos)                                         / 1.F;
+        const float sp          = options.EvalSpace      * pawn_terms[1]                                         / 5.F;
+        const float pawn_struct = options.EvalPawnStruct * pawn_terms[0]                                         / 5.F;
+        const float p_attacks   =                          pawn_attacks(pos, info)                               / 2.F;
+        const float knight      = options.EvalKnights    * knights(white[KNIGHT], black[KNIGHT], white[PAWN], black[PAWN]) / 16.F;
+        const float rook        = options.EvalRooks      * rooks(white[ROOK], black[ROOK], white[PAWN], black[PAWN])       / 2.F;
+        const float queen       = options.EvalQueens     * queens(pos, info)                                     / 6.F;
+        const float king        = options.EvalKings      * kings(white[KING], black[KING])                       / 16.F;
 
         // Endgame and middle game are for weighting categories.
         const float mg = middle_game(pawn_struct, p_attacks, knight, rook, queen, king, sp);
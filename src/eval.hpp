@@ -31,6 +31,26 @@ using std::endl;
 using std::vector;
 using std::string;
 
+struct PawnEntry {
+    U64 key;
+    float structure;  // Unweighted Eval::pawn_structure
+    float space;      // Unweighted Eval::space
+};
+
+struct PawnTable {
+    /*
+    Pawn terms keyed by Position::pawn_hash, always replaces.
+    Each search thread owns one, so there is no locking.
+    */
+    PawnTable(const int&);
+    ~PawnTable();
+    bool probe(const U64&, float&, float&);
+    void store(const U64&, const float&, const float&);
+
+    PawnEntry* entries;
+    U64 size;
+};
+
 namespace Eval {
     constexpr int MIDGAME_LIM = 50;
     constexpr int ENDGAME_LIM = 20;
@@ -40,9 +60,12 @@ namespace Eval {
     void init();
     char center_dist(const char&);
 
+    float space(const U64&, const U64&);
+    float pawn_structure(const U64&, const U64&);
     float material(const Position&);
     float total_mat(const Position&);
     float non_pawn_mat(const Position&);
 
-    float eval(const Options&, const Position&, const vector<Move>&, const int&, const U64&, const bool=false);
+    float eval(const Options&, const Position&, const MoveList&, const int&, const AttackInfo&, PawnTable* const=nullptr,
+        const bool=false);
 }
@@ -32,54 +32,55 @@ using std::string;
 
 
 namespace Hash {
-    U64 piece_bits[101][64][12];
+    U64 piece_bits[12][64];
     U64 ep_square[64];
-    U64 turn[2];
-    U64 ep[2];
-    U64 castling[15];
+    U64 turn;
+    U64 castling[16];
 
     void init() {
-        for (UCH i = 0; i < 101; i++) {
+        for (UCH i = 0; i < 12; i++) {
             for (UCH j = 0; j < 64; j++) {
-                for (UCH k = 0; k < 12; k++) {
-                    piece_bits[i][j][k] = randull();
-                }
+                piece_bits[i][j] = randull();
             }
         }
         for (UCH i = 0; i < 64; i++) {
             ep_square[i] = randull();
         }
-        for (UCH i = 0; i < 15; i++) {
-            castling[i] = randull();
+        turn = randull();
+
+        // One key per right, combined so that removing a right is a single xor of two entries.
+        U64 rights[4];
+        for (UCH i = 0; i < 4; i++) rights[i] = randull();
+        for (UCH i = 0; i < 16; i++) {
+            castling[i] = 0;
+            for (UCH j = 0; j < 4; j++) {
+                if (Bitboard::bit(i, j)) castling[i] ^= rights[j];
+            }
         }
-        turn[0] = randull();
-        turn[1] = randull();
-        ep[0] = randull();
-        ep[1] = randull();
     }
 
     U64 hash(const Position& pos) {
-        const U64 kings = pos.wk | pos.bk;
-        const UCH idx = kings % 101;
+        /*
+        Computes the key from scratch.
+        Search uses pos.hash, which Bitboard::push keeps equal to this.
+        */
         U64 value = 0;
         for (UCH i = 0; i < 64; i++) {
-            if      (Bitboard::bit(pos.wp, i)) value ^= piece_bits[idx][i][0];
-            else if (Bitboard::bit(pos.wn, i)) value ^= piece_bits[idx][i][1];
-            else if (Bitboard::bit(pos.wb, i)) value ^= piece_bits[idx][i][2];
-            else if (Bitboard::bit(pos.wr, i)) value ^= piece_bits[idx][i][3];
-            else if (Bitboard::bit(pos.wq, i)) value ^= piece_bits[idx][i][4];
-            else if (Bitboard::bit(pos.wk, i)) value ^= piece_bits[idx][i][5];
-            else if (Bitboard::bit(pos.bp, i)) value ^= piece_bits[idx][i][6];
-            else if (Bitboard::bit(pos.bn, i)) value ^= piece_bits[idx][i][7];
-            else if (Bitboard::bit(pos.bb, i)) value ^= piece_bits[idx][i][8];
-            else if (Bitboard::bit(pos.br, i)) value ^= piece_bits[idx][i][9];
-            else if (Bitboard::bit(pos.bq, i)) value ^= piece_bits[idx][i][10];
-            else if (Bitboard::bit(pos.bk, i)) value ^= piece_bits[idx][i][11];
+            if (pos.board[i] != Bitboard::NO_PIECE) value ^= piece_bits[pos.board[i]][i];
         }
-        value ^= turn[pos.turn];
-        value ^= ep[pos.ep];
+        if (!pos.turn) value ^= turn;
+        if (ep_hashed(pos)) value ^= ep_square[pos.ep_square];
         value ^= castling[pos.castling];
-        value ^= ep_square[pos.ep_square];
+        return value;
+    }
+
+    U64 pawn_hash(const Position& pos) {
+        // Computes the pawn key from scratch, kept in pos.pawn_hash like the main key.
+        U64 value = 0;
+        for (const bool color: {false, true}) {
+            const UCH piece = Bitboard::make_piece(color, PAWN);
+            for (U64 pawns = pos.bb[color][PAWN]; pawns;) value ^= piece_bits[piece][(int)Bitboard::pop_lsb(pawns)];
+        }
         return value;
     }
 }
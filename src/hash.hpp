@@ -31,6 +31,18 @@ using std::vector;
 using std::string;
 
 namespace Hash {
+    // Zobrist keys, also used by Bitboard::push to update Position::hash.
+    extern U64 piece_bits[12][64];
+    extern U64 ep_square[64];
+    extern U64 turn;
+    extern U64 castling[16];
+
+    inline bool ep_hashed(const Position& pos) {
+        // The en passant key is only used when a pawn can capture there, so that transpositions share a key.
+        return pos.ep && (Bitboard::PAWN_ATTACKS[!pos.turn][(int)pos.ep_square] & pos.bb[pos.turn][PAWN]);
+    }
+
     void init();
     U64 hash(const Position&);
+    U64 pawn_hash(const Position&);
 }
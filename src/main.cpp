@@ -20,6 +20,7 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <algorithm>
 #include "uci.hpp"
 #include "bitboard.hpp"
 #include "random.hpp"
@@ -74,17 +75,20 @@ void bench() {
         "8/8/8/8/8/k7/8/K7 w - - 0 1",
     };
 
-    U64 nodes = 0;
+    U64 nodes = 0, probes = 0, probe_cycles = 0;
     const double start = get_time();
-    bool searching = true;
+    std::atomic<bool> searching(true);
+    ThreadPool pool;
 
     for (UCH i = 0; i < num_pos; i++) {
         cout << "Position " << i+1 << " of " << +num_pos << endl;
         cout << "Fen: " << fens[i] << endl;
 
         const Position pos = Bitboard::parse_fen(fens[i]);
-        const SearchInfo result = Search::search(options, pos, depth, 10000, false, searching, false);
+        const SearchInfo result = Search::search(options, pos, depth, 10000, false, searching, false, pool, true);
         nodes += result.nodes;
+        probes += result.probes;
+        probe_cycles += result.probe_cycles;
     }
 
     const double elapse = get_time() - start;
@@ -94,20 +98,21 @@ void bench() {
     cout << "Nodes: " << nodes << endl;
     cout << "NPS: " << nps << endl;
     cout << "Time: " << elapse << " seconds" << endl;
+    cout << "TT probe latency: " << (double)probe_cycles / std::max(probes, (U64)1) << " cycles" << endl;
 }
 
 
 int main(const int argc, const char* argv[]) {
     cout << std::fixed;
     Random::set_seed(1234);
+    Bitboard::init();
+    Hash::init();
+    Eval::init();
 
     if (argc >= 2) {
         if      (argv[1] == string("--version")) cout << VERSION << endl;
         else if (argv[1] == string("bench")) bench();
     } else {
-        Hash::init();
-        Eval::init();
-
         print_info();
         return loop();
     }
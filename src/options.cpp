@@ -20,9 +20,20 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
 #include "options.hpp"
 
-#define HASH_FACTOR  348000
+#if defined(__linux__)
+    #include <sys/mman.h>
+#endif
+
+#define HASH_FACTOR  16384  // Buckets per MB
+#define HUGE_PAGE    2097152  // Bytes, tables this large are aligned to it so they can be backed by huge pages.
+
+static_assert(sizeof(TTBucket) == 64, "A bucket should fill one cache line.");
 
 using std::cin;
 using std::cout;
@@ -34,9 +45,52 @@ using std::string;
 Transposition::Transposition() {
 }
 
+Move Transposition::move() const {
+    Move move;
+    move.data = data & 0xFFFF;
+    return move;
+}
+
+short Transposition::score() const {
+    return (short)(data >> 16);
+}
+
+int Transposition::depth() const {
+    return (char)(data >> 32);
+}
+
+Bound Transposition::bound() const {
+    return (Bound)((data >> 40) & 3);
+}
+
+UCH Transposition::age() const {
+    return (data >> 42) & 63;
+}
+
+void Transposition::save(const U64& hash, const Move& _move, const short& _score, const int& _depth,
+        const Bound& _bound, const UCH& _age) {
+    /*
+    Writes the entry unless it already holds a deeper result for the same position.
+    The move is kept if the new result has none.
+    Both words are written with plain 64 bit stores, a reader that sees only one of them rejects the entry.
+    */
+    Transposition old;
+    old.data = data;
+    old.check = check;
+    const bool same = (old.check ^ old.data) == hash;
+    if (same && _depth < old.depth() && _bound != BOUND_EXACT && _age == old.age()) return;
+
+    const Move move = (_move == Move(0, 0) && same) ? old.move() : _move;
+    const U64 _data = (U64)move.data | ((U64)(U16)_score << 16) | ((U64)(UCH)_depth << 32) | ((U64)_bound << 40) |
+        ((U64)_age << 42);
+    check = hash ^ _data;
+    data = _data;
+}
 
 Options::Options() {
     Hash           = 256;
+    PawnHash       = 4;
+    Threads        = 1;
 
     EvalMaterial   = 1;
     EvalPawnStruct = 1;
@@ -49,19 +103,122 @@ Options::Options() {
     OwnBook        = false;
     OwnBookPath    = "openings.txt";
 
-    hash_table = new Transposition[16];
+    age = 0;
+    hash_table = nullptr;
     set_hash();
 }
 
 void Options::set_hash() {
-    delete[] hash_table;
+    /*
+    Allocates the table aligned to a huge page and asks the kernel to back it with huge pages,
+    which saves most TLB misses on large tables. Done before setoption returns, so a following
+    isready is only answered once the table is ready.
+    */
+    free_hash();
     hash_size = Hash * HASH_FACTOR;
-    hash_table = new Transposition[hash_size];
+    const U64 bytes = (hash_size*sizeof(TTBucket) + HUGE_PAGE-1) / HUGE_PAGE * HUGE_PAGE;
+
+    #if defined(_WIN32)
+        hash_table = (TTBucket*)_aligned_malloc(bytes, HUGE_PAGE);
+    #else
+        hash_table = (TTBucket*)std::aligned_alloc(HUGE_PAGE, bytes);
+    #endif
+    if (hash_table == nullptr) {
+        std::cerr << "Could not allocate " << Hash << " MB of hash" << endl;
+        std::exit(1);
+    }
+    #if defined(__linux__) && defined(MADV_HUGEPAGE)
+        madvise(hash_table, bytes, MADV_HUGEPAGE);
+    #endif
+
     clear_hash();
 }
 
+void Options::free_hash() {
+    #if defined(_WIN32)
+        _aligned_free(hash_table);
+    #else
+        std::free(hash_table);
+    #endif
+    hash_table = nullptr;
+}
+
 void Options::clear_hash() {
-    for (unsigned int i = 0; i < hash_size; i++) {
-        hash_table[i].depth = 0;
+    /*
+    Zeroes the table, which marks every entry empty.
+    Split over all cores, which also spreads the first touch of each page.
+    */
+    const U64 threads = std::max(std::thread::hardware_concurrency(), 1U);
+    const U64 chunk = (hash_size + threads-1) / threads;
+    vector<std::thread> workers;
+    for (U64 i = 0; i < threads; i++) {
+        const U64 start = std::min(i*chunk, hash_size), end = std::min(start+chunk, hash_size);
+        workers.emplace_back([this, start, end]() {
+            std::memset((void*)(hash_table+start), 0, (end-start)*sizeof(TTBucket));
+        });
+    }
+    for (std::thread& worker: workers) worker.join();
+}
+
+void Options::new_search() {
+    // Entries from earlier searches stay usable but are replaced first.
+    age = (age+1) & 63;
+}
+
+int Options::hashfull() const {
+    // Permille of entries written by the current search, sampled from the first buckets.
+    const U64 buckets = std::min(hash_size, (U64)1000);
+    U64 used = 0;
+    for (U64 i = 0; i < buckets; i++) {
+        for (const Transposition& entry: hash_table[i].entries) {
+            if (entry.bound() != BOUND_NONE && entry.age() == age) used++;
+        }
+    }
+    return 1000 * used / (buckets*BUCKET_SIZE);
+}
+
+TTBucket* Options::bucket(const U64& hash) const {
+    return &hash_table[(U64)(((unsigned __int128)hash * hash_size) >> 64)];
+}
+
+void Options::prefetch(const U64& hash) const {
+    // Starts loading the bucket of a position that will be probed soon.
+    #if defined(__GNUC__)
+        __builtin_prefetch(bucket(hash));
+    #endif
+}
+
+Transposition* Options::probe(const U64& hash, bool& found, Transposition& hit) const {
+    /*
+    Finds the entry of a position, one bucket and so one cache line per probe.
+    found: Set to whether the entry holds this position, otherwise the returned
+        entry is the one to replace: the shallowest, with older entries counting as shallower.
+    hit: Set to a verified copy of the entry if found, read it instead of the shared entry
+        which other threads may overwrite at any time.
+    */
+    Transposition* const entries = bucket(hash)->entries;
+    Transposition* replace = entries;
+    int worst = 1000;
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        Transposition& entry = entries[i];
+        Transposition copy;
+        copy.data = entry.data;
+        copy.check = entry.check;
+        if (copy.bound() == BOUND_NONE) {
+            found = false;
+            return &entry;
+        }
+        if ((copy.check ^ copy.data) == hash) {
+            found = true;
+            hit = copy;
+            return &entry;
+        }
+        const int value = copy.depth() - 8*((age - copy.age()) & 63);
+        if (value < worst) {
+            worst = value;
+            replace = &entry;
+        }
     }
+    found = false;
+    return replace;
 }
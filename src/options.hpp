@@ -30,17 +30,38 @@ using std::endl;
 using std::vector;
 using std::string;
 
+enum Bound {BOUND_NONE, BOUND_UPPER, BOUND_LOWER, BOUND_EXACT};
+
 struct Transposition {
+    /*
+    16 bytes, four share a 64 byte bucket. Scores are stored as int16, see Search::score_to_tt.
+    An entry with BOUND_NONE is empty. Shared by all search threads without locking: check holds
+    the full key xor data, so an entry torn by another thread fails verification.
+    */
     Transposition();
+    Move move() const;
+    short score() const;
+    int depth() const;
+    Bound bound() const;
+    UCH age() const;
+    void save(const U64&, const Move&, const short&, const int&, const Bound&, const UCH&);
+
+    U64 check;
+    U64 data;   // Move and score in 16 bits each, then depth in 8, bound in 2 and age in 6.
+};
+
+constexpr int BUCKET_SIZE = 4;
 
-    char depth;
-    char from;  // First six bits = square, last two = promo piece
-    char to;    // First six bits = square, seventh = is_promo
+struct alignas(64) TTBucket {
+    Transposition entries[BUCKET_SIZE];
 };
 
 class Options {
 /*
 Hash: type=spin, default=256, min=1, max=65536, hash table size (megabytes)
+Clear Hash: type=button, empties the hash table, which otherwise keeps entries between searches.
+PawnHash: type=spin, default=4, min=1, max=1024, pawn hash table size per search thread (megabytes)
+Threads: type=spin, default=1, min=1, max=256, number of search threads sharing the hash table.
 
 EvalMaterial: type=spin, default=100, min=0, max=1000, weight (percent) of material eval.
 EvalSpace: type=spin, default=100, min=0, max=1000, weight (percent) of space eval.
@@ -54,12 +75,21 @@ EvalKings: type=spin, default=100, min=0, max=1000, weight (percent) of king eva
 public:
     Options();
     void set_hash();
+    void free_hash();
     void clear_hash();
+    TTBucket* bucket(const U64&) const;
+    void prefetch(const U64&) const;
+    Transposition* probe(const U64&, bool&, Transposition&) const;
+    void new_search();
+    int hashfull() const;
 
-    Transposition* hash_table;
-    U64 hash_size;
+    TTBucket* hash_table;
+    U64 hash_size;  // Number of buckets.
+    UCH age;        // Stored in new entries, older entries are replaced first.
 
     int Hash;
+    int PawnHash;
+    int Threads;
 
     float EvalMaterial;
     float EvalSpace;
@@ -20,7 +20,11 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 #include "bitboard.hpp"
+#include "perft.hpp"
 #include "utils.hpp"
 #include "hash.hpp"
 #include "eval.hpp"
@@ -32,18 +36,126 @@ using std::vector;
 using std::string;
 
 
+PerftTable::PerftTable(const int& mb) {
+    size = std::max((U64)mb * 1048576 / sizeof(PerftEntry), (U64)1);
+    entries = new PerftEntry[size]();
+    probes = 0;
+    hits = 0;
+}
+
+PerftTable::~PerftTable() {
+    delete[] entries;
+}
+
+bool PerftTable::probe(const U64& key, const int& depth, long long& nodes) const {
+    const PerftEntry& entry = entries[(key+depth) % size];
+    const U64 data = entry.data;
+    if ((entry.check ^ data) != key || (data >> 56) != (U64)depth) return false;
+    nodes = data & ((1ULL<<56) - 1);
+    return true;
+}
+
+void PerftTable::store(const U64& key, const int& depth, const long long& nodes) {
+    PerftEntry& entry = entries[(key+depth) % size];
+    const U64 data = ((U64)depth << 56) | (U64)nodes;
+    entry.check = key ^ data;
+    entry.data = data;
+}
+
+
 namespace Perft {
-    long long movegen(const Position& pos, const int& depth) {
+    long long movegen(Position& pos, const int& depth, const bool bulk, PerftTable* const table,
+            PerftThread* const stats) {
+        /*
+        Counts leaf nodes.
+        bulk: Count the moves at depth 1 instead of making each of them.
+        table: Optional cache of subtree counts, only used from depth 2 where hashing is cheaper than counting.
+        stats: Optional per thread counters of hash probes and hits.
+        */
         if (depth == 0) return 1;
+        AttackInfo info;
+        Bitboard::attack_info(pos, info);
+        if (bulk && depth == 1) return Bitboard::count_moves(pos, info);
 
         long long count = 0;
-        for (const auto& move: Bitboard::legal_moves(pos, Bitboard::attacked(pos, !pos.turn))) {
-            const Position new_pos = Bitboard::push(pos, move);
-            count += movegen(new_pos, depth-1);
+        const bool hashed = (table != nullptr) && (depth >= 2);
+        const U64 key = hashed ? pos.hash : 0;
+        if (hashed) {
+            const bool hit = table->probe(key, depth, count);
+            if (stats != nullptr) {
+                stats->probes++;
+                stats->hits += hit;
+            }
+            if (hit) return count;
+        }
+
+        MoveList moves;
+        Bitboard::legal_moves(pos, info, moves);
+        for (const auto& move: moves) {
+            Undo undo;
+            Bitboard::push(pos, move, undo);
+            count += movegen(pos, depth-1, bulk, table, stats);
+            Bitboard::pop(pos, move, undo);
         }
+
+        if (hashed) table->store(key, depth, count);
         return count;
     }
 
+    vector<long long> parallel(const Position& pos, const MoveList& root_moves, const int& depth, const int& threads,
+            const bool bulk, PerftTable* const table, vector<PerftThread>& stats) {
+        /*
+        Counts leaf nodes below each root move, spread over threads.
+        Work is split into root and second level subtrees, and each thread takes the next unclaimed
+        subtree until none are left, so threads that finish early keep pulling work.
+        Returns the count per root move, in the order of root_moves.
+        */
+        vector<PerftTask> tasks;
+        for (int i = 0; i < root_moves.size(); i++) {
+            if (depth < 3) {
+                tasks.push_back({i, {root_moves[i], Move(0, 0)}, 1, 0});
+                continue;
+            }
+            const Position child = Bitboard::push(pos, root_moves[i]);
+            MoveList moves;
+            AttackInfo info;
+            Bitboard::attack_info(child, info);
+            Bitboard::legal_moves(child, info, moves);
+            for (const auto& move: moves) tasks.push_back({i, {root_moves[i], move}, 2, 0});
+        }
+
+        std::atomic<size_t> next(0);
+        stats.assign(threads, PerftThread());
+        auto work = [&](const int id) {
+            const double start = get_time();
+            size_t i;
+            while ((i = next.fetch_add(1)) < tasks.size()) {
+                PerftTask& task = tasks[i];
+                Position curr = pos;
+                for (int j = 0; j < task.num_moves; j++) curr = Bitboard::push(curr, task.moves[j]);
+                task.nodes = movegen(curr, depth-task.num_moves, bulk, table, &stats[id]);
+                stats[id].nodes += task.nodes;
+            }
+            stats[id].time = get_time() - start;
+        };
+
+        vector<std::thread> pool;
+        for (int id = 1; id < threads; id++) pool.emplace_back(work, id);
+        work(0);
+        for (auto& thread: pool) thread.join();
+
+        if (table != nullptr) {
+            for (const auto& thread: stats) {
+                table->probes += thread.probes;
+                table->hits += thread.hits;
+            }
+        }
+
+        vector<long long> counts(root_moves.size(), 0);
+        for (const auto& task: tasks) counts[task.root] += task.nodes;
+        return counts;
+    }
+
     double hash_perft(const Position& pos, const int& knodes) {
         const double start = get_time();
         for (auto i = 0; i < knodes*1000; i++) Hash::hash(pos);
@@ -51,18 +163,44 @@ namespace Perft {
     }
 
     double eval_perft(const Options& options, const Position& pos, const int& knodes) {
-        const U64 o_attacks = Bitboard::attacked(pos, !pos.turn);
-        const vector<Move> moves = Bitboard::legal_moves(pos, o_attacks);
+        AttackInfo info;
+        Bitboard::attack_info(pos, info);
+        MoveList moves;
+        Bitboard::legal_moves(pos, info, moves);
 
         const double start = get_time();
-        for (auto i = 0; i < knodes*1000; i++) Eval::eval(options, pos, moves, 0, o_attacks);
+        for (auto i = 0; i < knodes*1000; i++) Eval::eval(options, pos, moves, 0, info);
         return get_time() - start;
     }
 
     double push_perft(const Position& pos, const int& knodes) {
-        const Move move = Bitboard::legal_moves(pos, Bitboard::attacked(pos, !pos.turn))[0];
+        AttackInfo info;
+        Bitboard::attack_info(pos, info);
+        MoveList moves;
+        Bitboard::legal_moves(pos, info, moves);
+        const Move move = moves[0];
+        Position curr = pos;
+        Undo undo;
+
         const double start = get_time();
-        for (auto i = 0; i < knodes*1000; i++) Bitboard::push(pos, move);
+        for (auto i = 0; i < knodes*1000; i++) {
+            Bitboard::push(curr, move, undo);
+            Bitboard::pop(curr, move, undo);
+        }
+        return get_time() - start;
+    }
+
+    double attacks_perft(const Position& pos, const int& knodes, const bool& setwise, U64& checksum) {
+        /*
+        Times the attack maps of both sides, with magic lookups or set-wise fills.
+        checksum: Sum of all maps, keeps the loop from being optimized out.
+        */
+        checksum = 0;
+        const double start = get_time();
+        for (auto i = 0; i < knodes*1000; i++) {
+            if (setwise) checksum += Bitboard::attacked_setwise(pos, i&1);
+            else checksum += Bitboard::attacked(pos, i&1);
+        }
         return get_time() - start;
     }
 }
@@ -23,6 +23,7 @@
 #include <vector>
 #include <string>
 #include "bitboard.hpp"
+#include "options.hpp"
 
 using std::cin;
 using std::cout;
@@ -30,9 +31,48 @@ using std::endl;
 using std::vector;
 using std::string;
 
+struct PerftEntry {
+    U64 check;  // Key xor data, so an entry torn by another thread fails verification.
+    U64 data;   // Nodes in the low 56 bits, depth in the high 8.
+};
+
+struct PerftTable {
+    /*
+    Leaf counts of already searched subtrees, keyed by hash and depth.
+    Always replaces, entries are 16 bytes. Shared by all perft threads without locking.
+    */
+    PerftTable(const int&);
+    ~PerftTable();
+    bool probe(const U64&, const int&, long long&) const;
+    void store(const U64&, const int&, const long long&);
+
+    PerftEntry* entries;
+    U64 size;
+    U64 probes;  // Summed from the threads once a parallel run is done.
+    U64 hits;
+};
+
+struct alignas(64) PerftThread {
+    // Own cache line per thread, as the hash counters change on every probe.
+    long long nodes;
+    double time;  // Seconds spent counting, excluding waiting at the end.
+    U64 probes;
+    U64 hits;
+};
+
+struct PerftTask {
+    int root;       // Index of the root move.
+    Move moves[2];  // Root move and, when split further, second level move.
+    int num_moves;
+    long long nodes;
+};
+
 namespace Perft {
-    long long movegen(const Position&, const int&);
+    long long movegen(Position&, const int&, const bool=true, PerftTable* const=nullptr, PerftThread* const=nullptr);
+    vector<long long> parallel(const Position&, const MoveList&, const int&, const int&, const bool, PerftTable* const,
+        vector<PerftThread>&);
     double hash_perft(const Position&, const int&);
     double eval_perft(const Options&, const Position&, const int&);
     double push_perft(const Position&, const int&);
+    double attacks_perft(const Position&, const int&, const bool&, U64&);
 }
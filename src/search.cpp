@@ -21,6 +21,9 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <cmath>
+#include <thread>
+#include <memory>
 #include "bitboard.hpp"
 #include "search.hpp"
 #include "eval.hpp"
@@ -37,6 +40,8 @@ using std::string;
 
 
 SearchInfo::SearchInfo() {
+    probes = 0;
+    probe_cycles = 0;
 }
 
 SearchInfo::SearchInfo(const int& _depth, const int& _seldepth, const float& _score, const U64& _nodes, const int& _nps,
@@ -53,6 +58,8 @@ SearchInfo::SearchInfo(const int& _depth, const int& _seldepth, const float& _sc
     alpha = _alpha;
     beta = _beta;
     full = _full;
+    probes = 0;
+    probe_cycles = 0;
 }
 
 string SearchInfo::as_string() {
@@ -82,7 +89,144 @@ bool SearchInfo::is_mate() {
 }
 
 
+SearchThread::SearchThread(const int& _id, const int& pawn_mb) : pawns(pawn_mb) {
+    id = _id;
+    reset();
+}
+
+void SearchThread::reset() {
+    // Clears the per search state, the pawn table is kept as its entries do not go stale.
+    nodes = 0;
+    probes = 0;
+    probe_cycles = 0;
+    for (auto& moves: killers) moves[0] = moves[1] = Move(0, 0);
+    result = SearchInfo(0, 0, 0, 0, 0, 0, 0, {}, 0, 0, false);
+}
+
+ThreadPool::ThreadPool() {
+    pawn_mb = 0;
+}
+
+void ThreadPool::resize(const int& num_threads, const int& _pawn_mb) {
+    // Keeps existing threads unless the pawn table size changed, then resets all of them.
+    if (_pawn_mb != pawn_mb) {
+        threads.clear();
+        pawn_mb = _pawn_mb;
+    }
+    threads.resize(std::min((int)threads.size(), num_threads));
+    while ((int)threads.size() < num_threads) threads.push_back(std::make_unique<SearchThread>(threads.size(), pawn_mb));
+    for (auto& thread: threads) thread->reset();
+}
+
+
+MovePicker::MovePicker(const Position& _pos, const AttackInfo& _info, const Move& _hash_move, const Move* _killers)
+        : pos(_pos), info(_info) {
+    hash_move = _hash_move;
+    killers[0] = _killers[0];
+    killers[1] = _killers[1];
+    stage = HASH_MOVE;
+    index = 0;
+}
+
+bool MovePicker::next(Move& move) {
+    /*
+    Gets the next move to search.
+    move: Set to the move if one is left.
+    Returns false once all moves have been handed out.
+    */
+    const Move none(0, 0);
+    switch (stage) {
+        case HASH_MOVE:
+            stage = CAPTURES_INIT;
+            if (hash_move != none && Bitboard::is_pseudo_legal(pos, hash_move) && Bitboard::is_legal(pos, hash_move, info)) {
+                move = hash_move;
+                return true;
+            }
+            hash_move = none;
+            [[fallthrough]];
+
+        case CAPTURES_INIT:
+            Bitboard::legal_moves(pos, info, captures, Bitboard::GEN_CAPTURES);
+            for (int i = 0; i < captures.size(); i++) {
+                // MVV-LVA, promotions count the piece gained.
+                const Move& capture = captures[i];
+                const UCH attacker = Bitboard::type_of(pos.board[capture.from()]);
+                const UCH victim = capture.is_ep() ? PAWN : Bitboard::type_of(pos.board[capture.to()]);
+                scores[i] = -attacker;
+                if (capture.is_capture()) scores[i] += 16 * Search::PIECE_VALUES[victim];
+                if (capture.is_promo()) scores[i] += 16 * Search::PIECE_VALUES[KNIGHT+capture.promo()];
+            }
+            index = 0;
+            stage = CAPTURES;
+            [[fallthrough]];
+
+        case CAPTURES:
+            while (index < captures.size()) {
+                // Selection sort one step at a time, most moves are never reached.
+                int best = index;
+                for (int i = index+1; i < captures.size(); i++) {
+                    if (scores[i] > scores[best]) best = i;
+                }
+                std::swap(captures[index], captures[best]);
+                std::swap(scores[index], scores[best]);
+
+                move = captures[index++];
+                if (move != hash_move) return true;
+            }
+            index = 0;
+            stage = KILLERS;
+            [[fallthrough]];
+
+        case KILLERS:
+            while (index < 2) {
+                const Move& killer = killers[index++];
+                if (killer == none || killer == hash_move) continue;
+                if (Bitboard::is_pseudo_legal(pos, killer) && Bitboard::is_legal(pos, killer, info)) {
+                    move = killer;
+                    return true;
+                }
+            }
+            stage = QUIETS_INIT;
+            [[fallthrough]];
+
+        case QUIETS_INIT:
+            Bitboard::legal_moves(pos, info, quiets, Bitboard::GEN_QUIETS);
+            index = 0;
+            stage = QUIETS;
+            [[fallthrough]];
+
+        case QUIETS:
+            while (index < quiets.size()) {
+                move = quiets[index++];
+                if (move != hash_move && move != killers[0] && move != killers[1]) return true;
+            }
+            stage = DONE;
+            [[fallthrough]];
+
+        default:
+            return false;
+    }
+}
+
+
 namespace Search {
+    short score_to_tt(const float& score, const int& ply) {
+        /*
+        Mate scores keep their exact distance, other scores are rounded to centipawns.
+        ply: Distance of the node from the root. Search mate scores count plies from the root,
+            stored ones count from the node so they stay valid when reached by another path.
+        */
+        if (score >= MATE_BOUND_MAX) return TT_MATE - ((short)(MAX-score) - ply);
+        if (score <= MATE_BOUND_MIN) return -TT_MATE + ((short)(score-MIN) - ply);
+        return std::clamp((int)std::round(100*score), -(int)TT_MAX_CP, (int)TT_MAX_CP);
+    }
+
+    float score_from_tt(const short& score, const int& ply) {
+        if (score > TT_MAX_CP) return MAX - (TT_MATE-score) - ply;
+        if (score < -TT_MAX_CP) return MIN + (score+TT_MATE) + ply;
+        return score / 100.F;
+    }
+
     float move_time(const Options& options, const Position& pos, const float& time, const float& inc) {
         const int moves = std::max(55-pos.move_cnt, 5);
         const float time_left = time + inc*moves;
@@ -91,87 +235,166 @@ namespace Search {
     }
 
 
-    SearchInfo dfs(const Options& options, const Position& pos, const int& depth, const int& real_depth,
-            float alpha, float beta, const bool& root, const double& endtime, bool& searching, U64& hash_filled) {
-        const U64 o_attacks = Bitboard::attacked(pos, !pos.turn);
-        vector<Move> moves = Bitboard::legal_moves(pos, o_attacks);
+    template <bool TimeProbes>
+    SearchInfo dfs(const Options& options, Position& pos, const int& depth, const int& real_depth,
+            float alpha, float beta, const bool& root, const double& endtime, std::atomic<bool>& searching,
+            SearchThread& thread) {
+        KillerTable& killers = thread.killers;
+        AttackInfo info;
+        Bitboard::attack_info(pos, info);
 
-        if (depth == 0 || moves.empty()) {
-            const float score = Eval::eval(options, pos, moves, real_depth, o_attacks);
+        if (depth == 0) {
+            MoveList moves;
+            Bitboard::legal_moves(pos, info, moves);
+            const float score = Eval::eval(options, pos, moves, real_depth, info, &thread.pawns);
             return SearchInfo(depth, depth, score, 1, 0, 0, 0, {}, alpha, beta, true);
         }
 
-        // Parse and store best move
-        const U64 idx = Hash::hash(pos) % options.hash_size;
-        Transposition& entry = options.hash_table[idx];
-        const Move best(entry.from&63, entry.to&63, entry.to&64, (entry.from&192)>>6);
-        if (entry.depth > 0) moves.insert(moves.begin(), best);
+        // Moves are generated lazily, the hash move is tried first.
+        bool found;
+        Transposition hit;
+        Transposition* entry;
+        if constexpr (TimeProbes) {
+            const U64 probe_start = get_cycles();
+            entry = options.probe(pos.hash, found, hit);
+            thread.probe_cycles += get_cycles() - probe_start;
+            thread.probes++;
+        } else {
+            entry = options.probe(pos.hash, found, hit);
+        }
+        const int ply = std::min(real_depth, MAX_PLY-1);
+        if (found && !root && hit.depth() >= depth) {
+            // The stored result is deep enough, use it if its bound decides this window.
+            // Cutoffs are strict, a bound equal to alpha or beta could still be an exact score.
+            const float score = score_from_tt(hit.score(), real_depth);
+            const Bound bound = hit.bound();
+            if (bound == BOUND_EXACT || (bound == BOUND_LOWER && score > beta) || (bound == BOUND_UPPER && score < alpha)) {
+                return SearchInfo(depth, depth, score, 1, 0, 0, 0, {}, alpha, beta, true);
+            }
+        }
+        MovePicker picker(pos, info, found ? hit.move() : Move(0, 0), killers[ply]);
+        const float alpha_init = alpha, beta_init = beta;
 
         U64 nodes = 1;
         vector<Move> pv;
-        int best_ind = 0;
+        Move move, best_move;
+        int movenum = 0;
         float best_eval = pos.turn ? MIN : MAX;
         bool full = true;
-        int movecnt = 0;  // Need to use this bc will skip a repeated best move so i != movecnt
-        for (unsigned int i = 0; i < moves.size(); i++) {
+        while (picker.next(move)) {
+            if (movenum++ == 0) best_move = move;
             if (depth >= 3) {
-                if ((get_time() >= endtime) || !searching) {
+                if ((get_time() >= endtime) || !searching.load(std::memory_order_relaxed)) {
                     full = false;
                     break;
                 }
             }
-            if ((i != 0) && (entry.depth > 0)) {  // Don't search best move twice
-                const Move& curr = moves[i];
-                if ((best.from == curr.from) && (best.to == curr.to) && (best.is_promo == curr.is_promo) &&
-                        (best.promo == curr.promo)) continue;
-            }
-            movecnt++;
-
-            const Position new_pos = Bitboard::push(pos, moves[i]);
-            const SearchInfo result = dfs(options, new_pos, depth-1, real_depth+1, alpha, beta, false, endtime, searching, hash_filled);
+            Undo undo;
+            Bitboard::push(pos, move, undo);
+            // The child probes after computing its attacks, which hides most of the memory latency.
+            if (depth > 1) options.prefetch(pos.hash);
+            const SearchInfo result = dfs<TimeProbes>(options, pos, depth-1, real_depth+1, alpha, beta, false, endtime, searching,
+                thread);
+            Bitboard::pop(pos, move, undo);
             nodes += result.nodes;
+            if (!result.full) {
+                // An aborted child's score is partial, so neither use nor store it.
+                full = false;
+                break;
+            }
 
-            if (root && (depth >= 5)) {
-                cout << "info depth " << depth << " currmove " << Bitboard::move_str(moves[i]) << " currmovenumber " << movecnt << endl;
+            if (root && (depth >= 5) && (thread.id == 0)) {
+                cout << "info depth " << depth << " currmove " << Bitboard::move_str(move) << " currmovenumber " << movenum << endl;
             }
 
             if (pos.turn) {
                 if (result.score > best_eval) {
-                    best_ind = i;
+                    best_move = move;
                     best_eval = result.score;
                     pv = result.pv;
                 }
                 if (result.score > alpha) alpha = result.score;
-                if (beta < alpha) break;
             } else {
                 if (result.score < best_eval) {
-                    best_ind = i;
+                    best_move = move;
                     best_eval = result.score;
                     pv = result.pv;
                 }
                 if (result.score < beta) beta = result.score;
-                if (beta < alpha) break;
             }
+            if (beta < alpha) {
+                if (!move.is_capture() && !move.is_promo() && move != killers[ply][0]) {
+                    killers[ply][1] = killers[ply][0];
+                    killers[ply][0] = move;
+                }
+                break;
+            }
+        }
+
+        if (movenum == 0) {
+            // Checkmate or stalemate.
+            const float score = Eval::eval(options, pos, MoveList(), real_depth, info, &thread.pawns);
+            return SearchInfo(depth, depth, score, 1, 0, 0, 0, {}, alpha, beta, true);
         }
-        pv.insert(pv.begin(), moves[best_ind]);
+        pv.insert(pv.begin(), best_move);
 
-        if (depth > entry.depth) {
-            if (entry.depth == 0) hash_filled++;
+        if (full) {
+            // Fail low or high results only bound the score, ties are exact as the search only cuts past a bound.
+            Bound bound = BOUND_EXACT;
+            if (best_eval < alpha_init) bound = BOUND_UPPER;
+            else if (best_eval > beta_init) bound = BOUND_LOWER;
 
-            const Move& best_move = moves[best_ind];
-            entry.from = best_move.from + (best_move.promo<<6);
-            entry.to = best_move.to + (best_move.is_promo<<6);
-            entry.depth = depth;
+            entry->save(pos.hash, best_move, score_to_tt(best_eval, real_depth), depth, bound, options.age);
         }
 
         return SearchInfo(depth, depth, best_eval, nodes, 0, 0, 0, pv, alpha, beta, full);
     }
 
+    template <bool TimeProbes>
+    void iterate(const Options& options, const Position& pos, const int& depth, const double& start,
+            const double& end, const bool& infinite, std::atomic<bool>& searching, SearchThread& thread,
+            const vector<std::unique_ptr<SearchThread>>& threads) {
+        /*
+        Iterative deepening of one Lazy SMP thread.
+        Helpers start one depth later on odd ids so that threads spread over two depths and
+        fill the shared hash table with different parts of the tree. Only the main thread prints.
+        */
+        Position root = pos;
+        const bool main = (thread.id == 0);
+
+        for (int d = main ? 1 : 1 + thread.id%2; d <= depth; d++) {
+            if (!searching.load(std::memory_order_relaxed) || get_time() >= end) break;
+
+            SearchInfo curr_result = dfs<TimeProbes>(options, root, d, 0, MIN, MAX, true, end, searching, thread);
+            thread.nodes.store(thread.nodes.load(std::memory_order_relaxed) + curr_result.nodes,
+                std::memory_order_relaxed);
+
+            if (!pos.turn) curr_result.score *= -1;
+            if (curr_result.full) {
+                if (main) {
+                    U64 nodes = 0;
+                    for (const auto& t: threads) nodes += t->nodes.load(std::memory_order_relaxed);
+                    const double elapse = get_time() - start;
+                    curr_result.time = elapse;
+                    curr_result.nodes = nodes;
+                    curr_result.nps = nodes / (elapse+0.001);
+                    curr_result.hashfull = options.hashfull();
+                    cout << curr_result.as_string() << endl;
+                }
+                thread.result = curr_result;
+            }
+            if (curr_result.is_mate() && (curr_result.score > 0) && !infinite) break;
+        }
+    }
+
     SearchInfo search(const Options& options, const Position& pos, const int& depth, const double& movetime,
-            const bool& infinite, bool& searching, const bool& stop_early) {
+            const bool& infinite, std::atomic<bool>& searching, const bool& stop_early, ThreadPool& pool,
+            const bool time_probes) {
         const int eg = Endgame::eg_type(pos);
-        const U64 o_attacks = Bitboard::attacked(pos, !pos.turn);
-        const vector<Move> moves = Bitboard::legal_moves(pos, o_attacks);
+        AttackInfo info;
+        Bitboard::attack_info(pos, info);
+        MoveList moves;
+        Bitboard::legal_moves(pos, info, moves);
         if (false && (moves.size() == 1)) {
             return SearchInfo(1, 1, 0, 1, 1, 0, 0, {moves[0]}, 0, 0, true);
         }
@@ -180,35 +403,50 @@ namespace Search {
             return SearchInfo(1, 1, pos.turn ? MAX : MIN, moves.size(), 0, 0, 0, {best_move}, 0, 0, true);
         }
 
-        SearchInfo result;
-        U64 hash_filled = 0;
-        U64 nodes = 0;
         const double start = get_time();
         const double end = start + movetime;
+        const int num_threads = std::max(options.Threads, 1);
 
-        for (char d = 1; d <= depth; d++) {
-            if (!searching || get_time() >= end) break;
+        // Each thread owns its killers, pawn table and counters, the hash table is shared.
+        pool.resize(num_threads, options.PawnHash);
+        const vector<std::unique_ptr<SearchThread>>& threads = pool.threads;
 
-            SearchInfo curr_result = dfs(options, pos, d, 0, MIN, MAX, true, end, searching, hash_filled);
-            const double elapse = get_time() - start;
-            nodes += curr_result.nodes;
+        // Helpers stop once the main thread is done, which also covers a stop command.
+        std::atomic<bool> helpers_searching(true);
+        vector<std::thread> helpers;
+        const auto run = time_probes ? iterate<true> : iterate<false>;
+        for (int i = 1; i < num_threads; i++) {
+            helpers.emplace_back(run, std::cref(options), std::cref(pos), depth, start, end, infinite,
+                std::ref(helpers_searching), std::ref(*threads[i]), std::cref(threads));
+        }
+        run(options, pos, depth, start, end, infinite, searching, *threads[0], threads);
+        helpers_searching = false;
+        for (auto& helper: helpers) helper.join();
 
-            curr_result.time = elapse;
-            curr_result.nodes = nodes;
-            curr_result.nps = curr_result.nodes / (elapse+0.001);
-            curr_result.hashfull = 1000 * hash_filled / options.hash_size;
-            if (!pos.turn) curr_result.score *= -1;
-            if (curr_result.full) {
-                cout << curr_result.as_string() << endl;
-                result = curr_result;
+        // The deepest completed iteration wins, the main thread on ties.
+        SearchInfo result = threads[0]->result;
+        bool from_helper = false;
+        for (const auto& t: threads) {
+            if (t->result.pv.empty()) continue;
+            if (result.pv.empty() || t->result.depth > result.depth) {
+                result = t->result;
+                from_helper = true;
             }
-            if (curr_result.is_mate() && (curr_result.score > 0) && !infinite) break;
-
-            // if (stop_early && ((elapse/movetime) >= 0.6)) {    // Won't finish next depth so no point
-            //     break;
-            // }
         }
-
+        U64 nodes = 0, probes = 0, probe_cycles = 0;
+        for (const auto& t: threads) {
+            nodes += t->nodes;
+            probes += t->probes;
+            probe_cycles += t->probe_cycles;
+        }
+        const double elapse = get_time() - start;
+        result.time = elapse;
+        result.nodes = nodes;
+        result.nps = nodes / (elapse+0.001);
+        result.hashfull = options.hashfull();
+        result.probes = probes;
+        result.probe_cycles = probe_cycles;
+        if (from_helper) cout << result.as_string() << endl;
         return result;
     }
 }
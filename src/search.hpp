@@ -22,8 +22,11 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <atomic>
+#include <memory>
 #include "bitboard.hpp"
 #include "options.hpp"
+#include "eval.hpp"
 
 using std::cin;
 using std::cout;
@@ -50,17 +53,86 @@ struct SearchInfo {
     float alpha;
     float beta;
     bool full;
+
+    U64 probes;        // Transposition table probes, with the cycles spent in them. Only counted by bench.
+    U64 probe_cycles;
+};
+
+struct MovePicker {
+    /*
+    Hands out the legal moves of a node one at a time: hash move, captures by MVV-LVA,
+    killers, then quiet moves. Each stage is only generated once the previous one is used up,
+    so a cutoff on an early move skips generating and scoring the rest.
+    */
+    enum Stage {HASH_MOVE, CAPTURES_INIT, CAPTURES, KILLERS, QUIETS_INIT, QUIETS, DONE};
+
+    MovePicker(const Position&, const AttackInfo&, const Move&, const Move*);
+    bool next(Move&);
+
+    const Position& pos;
+    const AttackInfo& info;
+    Move hash_move;  // Move(0, 0) when there is none, same for killers.
+    Move killers[2];
+    int stage;
+    int index;
+    MoveList captures;
+    MoveList quiets;
+    int scores[Bitboard::MAX_MOVES];
 };
 
 namespace Search {
+    constexpr int MAX_PLY = 128;
+
+    typedef Move KillerTable[MAX_PLY][2];  // Two quiet moves per ply that caused a beta cutoff.
+
+    constexpr int PIECE_VALUES[6] = {1, 3, 3, 5, 9, 0};  // For move ordering, indexed by piece type.
+
     constexpr float MAX = 10000;
     constexpr float MIN = -10000;
 
     constexpr float MATE_BOUND_MAX = MAX - 100;
     constexpr float MATE_BOUND_MIN = MIN + 100;
 
+    // Transposition table scores, centipawns or TT_MATE minus the plies to mate from the stored node.
+    constexpr short TT_MATE = 32000;
+    constexpr short TT_MAX_CP = 30000;
+
+    short score_to_tt(const float&, const int&);
+    float score_from_tt(const short&, const int&);
+}
+
+struct alignas(64) SearchThread {
+    /*
+    Everything one Lazy SMP thread owns, only the transposition table is shared.
+    Aligned to a cache line so that counters of different threads never share one.
+    */
+    SearchThread(const int&, const int&);
+    void reset();
+
+    int id;                  // 0 is the main thread.
+    std::atomic<U64> nodes;  // Of completed iterations, summed over threads for info output.
+    U64 probes;
+    U64 probe_cycles;
+    Search::KillerTable killers;
+    PawnTable pawns;
+    SearchInfo result;       // Deepest completed iteration.
+};
+
+struct ThreadPool {
+    /*
+    Search threads kept between searches so the pawn tables stay warm.
+    Owned by whoever runs the searches, which must not overlap.
+    */
+    ThreadPool();
+    void resize(const int&, const int&);
+
+    vector<std::unique_ptr<SearchThread>> threads;
+    int pawn_mb;  // Size of the pawn tables of the threads.
+};
+
+namespace Search {
     float move_time(const Options&, const Position&, const float&, const float&);
 
     SearchInfo search(const Options&, const Position&, const int&, const double&, const bool&,
-        bool&, const bool&);
+        std::atomic<bool>&, const bool&, ThreadPool&, const bool=false);
 }
@@ -21,6 +21,8 @@
 #include <vector>
 #include <string>
 #include <thread>
+#include <atomic>
+#include <algorithm>
 #include "utils.hpp"
 #include "bitboard.hpp"
 #include "search.hpp"
@@ -79,7 +81,10 @@ Position parse_pos(const string& str, vector<string>& move_list) {
 
 
 void print_legal_moves(const Position& pos) {
-    const vector<Move> moves = Bitboard::legal_moves(pos, Bitboard::attacked(pos, !pos.turn));
+    AttackInfo info;
+    Bitboard::attack_info(pos, info);
+    MoveList moves;
+    Bitboard::legal_moves(pos, info, moves);
     cout << moves.size() << endl;
     for (const auto& m: moves) cout << Bitboard::move_str(m) << "\n";
 }
@@ -93,7 +98,8 @@ void chat(const Options& options, const bool& turn, const int& movect, const flo
     else if (!turn && (score > (prev_score+1.5))) cout << "info string " << rand_choice(LOSING)  << endl;
 }
 
-float go(const Options& options, const Position& pos, const vector<string>& parts, const float& prev_eval, bool& searching) {
+float go(const Options& options, const Position& pos, const vector<string>& parts, const float& prev_eval, std::atomic<bool>& searching,
+        ThreadPool& pool) {
     int mode = 0;
     int depth = 99;
     double movetime;
@@ -136,30 +142,64 @@ float go(const Options& options, const Position& pos, const vector<string>& part
     if (mode == 2) movetime /= 1.5;
 
     searching = true;
-    const SearchInfo result = Search::search(options, pos, depth, movetime, infinite, searching, (mode==2));
+    const SearchInfo result = Search::search(options, pos, depth, movetime, infinite, searching, (mode==2), pool);
     cout << "bestmove " << Bitboard::move_str(result.pv.front()) << endl;
 
     chat(options, pos.turn, pos.move_cnt, result.score, prev_eval);
     return result.score;
 }
 
-void perft(const Options& options, const Position& pos, const int& depth) {
-    const vector<Move> moves = Bitboard::legal_moves(pos, Bitboard::attacked(pos, !pos.turn));
-    const double start = get_time();
+void perft(const Options& options, const Position& pos, const int& depth, const int& hash_mb, const int& threads,
+        const bool& full_stats) {
+    /*
+    Counts leaf nodes with bulk counting at the last ply.
+    The final info line is the bulk run.
+    hash_mb: Size of the perft hash table used by the bulk run, 0 to disable.
+    threads: Number of threads the runs are split over.
+    full_stats: Also count again making every leaf move, without hash, and report it before the bulk run.
+    */
+    PerftTable* const table = (hash_mb > 0) ? new PerftTable(hash_mb) : nullptr;
+    AttackInfo info;
+    Bitboard::attack_info(pos, info);
+    MoveList moves;
+    Bitboard::legal_moves(pos, info, moves);
+    vector<PerftThread> stats;
+
+    double start = get_time();
+    const vector<long long> counts = Perft::parallel(pos, moves, depth, threads, true, table, stats);
+    const double elapse = get_time() - start + 0.001;  // Add 1 ms to prevent divide by 0
+
+    // Divide output is printed once all threads are done, so it is always in move order.
     long long nodes = 0;
+    for (int i = 0; i < moves.size(); i++) {
+        nodes += counts[i];
+        cout << "info currmove " << Bitboard::move_str(moves[i]) << " currmovenumber " << i+1 << " nodes " << counts[i] << endl;
+    }
+    for (int i = 0; i < threads; i++) {
+        cout << "info string thread " << i << " nodes " << stats[i].nodes << " nps "
+             << (long long)(stats[i].nodes/(stats[i].time+0.001)) << endl;
+    }
 
-    if (moves.size() > 0) {
-        int move_num = 1;
-        for (const auto& move: moves) {
-            const Position new_pos = Bitboard::push(pos, move);
-            const long long curr_nodes = Perft::movegen(new_pos, depth-1);
-            nodes += curr_nodes;
-            cout << "info currmove " << Bitboard::move_str(move) << " currmovenumber " << move_num << " nodes " << curr_nodes << endl;
-            move_num++;
+    if (full_stats) {
+        vector<PerftThread> full_thread_stats;
+        start = get_time();
+        long long full_nodes = 0;
+        for (const auto& count: Perft::parallel(pos, moves, depth, threads, false, nullptr, full_thread_stats)) {
+            full_nodes += count;
         }
-    }
+        const double full_elapse = get_time() - start + 0.001;
 
-    const double elapse = get_time() - start + 0.001;  // Add 1 ms to prevent divide by 0
+        cout << "info string full nodes " << full_nodes << " nps " << (long long)(full_nodes/full_elapse) << " time "
+             << (long long)(full_elapse*1000) << endl;
+    }
+    cout << "info string bulk nodes " << nodes << " nps " << (long long)(nodes/elapse) << " time "
+         << (long long)(elapse*1000) << endl;
+    cout << "info string threads " << threads << " nps per thread " << (long long)(nodes/elapse/threads) << endl;
+    if (table != nullptr) {
+        cout << "info string hash probes " << table->probes << " hits " << table->hits << " hitrate "
+             << (table->probes ? 100.0 * table->hits / table->probes : 0.0) << "%" << endl;
+        delete table;
+    }
     cout << "info depth " << depth << " nodes " << nodes << " nps " << (long long)(nodes/elapse) << " time " << (long long)(elapse*1000) << endl;
 }
 
@@ -178,6 +218,20 @@ void perft_push(const Position& pos, const int& knodes) {
     cout << "info nodes " << 1000*knodes << " nps " << (int)(knodes*1000/time) << " time " << (int)(time*1000) << endl;
 }
 
+void perft_attacks(const Position& pos, const int& knodes) {
+    /*
+    Compares the magic lookup attacked() against the set-wise backend.
+    Both have to produce the same maps, nps is attack maps per second.
+    */
+    U64 lookup_sum, setwise_sum;
+    const double lookup = Perft::attacks_perft(pos, knodes, false, lookup_sum);
+    const double setwise = Perft::attacks_perft(pos, knodes, true, setwise_sum);
+    const string backend = USE_AVX2 ? "avx2" : "scalar";
+    cout << "info string lookup nps " << (int)(knodes*1000/lookup) << " time " << (int)(lookup*1000) << endl;
+    cout << "info string setwise " << backend << " nps " << (int)(knodes*1000/setwise) << " time " << (int)(setwise*1000) << endl;
+    if (lookup_sum != setwise_sum) cout << "info string setwise attacks do not match" << endl;
+}
+
 
 int loop() {
     string cmd;
@@ -186,7 +240,9 @@ int loop() {
     Opening::load_openings(options);
     vector<string> move_list = {};
     float prev_eval = 0;
-    bool searching = false;
+    std::atomic<bool> searching(false);
+    ThreadPool pool;
+    std::thread search_thread;  // Joined before the next search and on stop or quit.
 
     while (getline(cin, cmd)) {
         cmd = strip(cmd);
@@ -201,6 +257,9 @@ int loop() {
             cout << "option name OwnBook type check default false\n";
             cout << "option name OwnBookPath type path default 'openings.txt'\n";
             cout << "option name Hash type spin default 256 min 1 max 65536\n";
+            cout << "option name Clear Hash type button\n";
+            cout << "option name PawnHash type spin default 4 min 1 max 1024\n";
+            cout << "option name Threads type spin default 1 min 1 max 256\n";
 
             cout << "option name EvalMaterial type spin default 100 min 0 max 1000\n";
             cout << "option name EvalPawnStruct type spin default 100 min 0 max 1000\n";
@@ -212,6 +271,7 @@ int loop() {
 
             cout << "uciok" << endl;
         }
+        else if (cmd == "setoption name Clear Hash") options.clear_hash();
         else if (startswith(cmd, "setoption")) {
             const vector<string> parts = split(cmd, " ");
             const string name = parts[2];
@@ -221,6 +281,8 @@ int loop() {
                 options.Hash = std::stoi(value);
                 options.set_hash();
             }
+            else if (name == "PawnHash") options.PawnHash = std::stoi(value);
+            else if (name == "Threads")  options.Threads  = std::max(std::stoi(value), 1);
 
             else if (name == "EvalMaterial")   options.EvalMaterial   = std::stof(value)/100;
             else if (name == "EvalPawnStruct") options.EvalPawnStruct = std::stof(value)/100;
@@ -248,7 +310,7 @@ int loop() {
         else if (startswith(cmd, "hash")) {
             const vector<string> parts = split(cmd, " ");
             if (parts.size() == 1) {
-                cout << Hash::hash(pos) << endl;
+                cout << pos.hash << endl;
             } else if (parts[1] == "perft" && parts.size() >= 2) {
                 perft_hash(options, pos, std::stoi(parts[2]));
             }
@@ -256,8 +318,11 @@ int loop() {
         else if (startswith(cmd, "eval")) {
             const vector<string> parts = split(cmd, " ");
             if (parts.size() == 1) {
-                const U64 attacked = Bitboard::attacked(pos, !pos.turn);
-                Eval::eval(options, pos, Bitboard::legal_moves(pos, attacked), 0, attacked, true);
+                AttackInfo info;
+                Bitboard::attack_info(pos, info);
+                MoveList moves;
+                Bitboard::legal_moves(pos, info, moves);
+                Eval::eval(options, pos, moves, 0, info, nullptr, true);
             } else if (parts[1] == "perft" && parts.size() >= 2) {
                 perft_eval(options, pos, std::stoi(parts[2]));
             }
@@ -267,16 +332,33 @@ int loop() {
             const vector<string> parts = split(cmd, " ");
             perft_push(pos, std::stoi(parts[1]));
         }
+        else if (startswith(cmd, "attacksperft")) {
+            const vector<string> parts = split(cmd, " ");
+            perft_attacks(pos, std::stoi(parts[1]));
+        }
         else if (cmd == "eg") cout << Endgame::eg_type(pos) << endl;
 
         else if (cmd == "ucinewgame") {
             pos = parse_pos("position startpos", move_list);
             prev_eval = 0;
+            options.clear_hash();
         }
         else if (startswith(cmd, "position")) pos = parse_pos(cmd, move_list);
         else if (startswith(cmd, "go")) {
             const vector<string> parts = split(cmd, " ");
-            if (parts.size() > 1 && parts[1] == "perft") perft(options, pos, std::stoi(parts[2]));
+            if (parts.size() > 1 && parts[1] == "perft") {
+                // go perft <depth> [hash <MB>] [threads <N>] [stats]
+                int hash_mb = 0;
+                int threads = std::max((int)std::thread::hardware_concurrency(), 1);
+                bool full_stats = false;
+                for (size_t i = 3; i < parts.size(); i++) {
+                    if (parts[i] == "stats") full_stats = true;
+                    else if (i+1 >= parts.size()) break;
+                    else if (parts[i] == "hash") hash_mb = std::stoi(parts[++i]);
+                    else if (parts[i] == "threads") threads = std::max(std::stoi(parts[++i]), 1);
+                }
+                perft(options, pos, std::stoi(parts[2]), hash_mb, threads, full_stats);
+            }
             else {
                 if (options.OwnBook) {
                     string moves = "";
@@ -293,16 +375,21 @@ int loop() {
                         continue;
                     }
                 }
-                options.clear_hash();
+                if (search_thread.joinable()) search_thread.join();
+                options.new_search();
                 searching = true;
-                std::thread(go, options, pos, parts, prev_eval, std::ref(searching)).detach();
+                search_thread = std::thread(go, options, pos, parts, prev_eval, std::ref(searching), std::ref(pool));
             }
         }
-        else if (cmd == "stop") searching = false;
+        else if (cmd == "stop") {
+            searching = false;
+            if (search_thread.joinable()) search_thread.join();
+        }
         else if (cmd.size() > 0) std::cerr << "Unknown command: " << cmd << endl;
     }
 
     searching = false;
-    delete[] options.hash_table;
+    if (search_thread.joinable()) search_thread.join();
+    options.free_hash();
     return 0;
 }
@@ -22,6 +22,9 @@
 #include <algorithm>
 #include <string>
 #include <chrono>
+#if defined(__GNUC__) && defined(__x86_64__)
+    #include <x86intrin.h>
+#endif
 #include "bitboard.hpp"
 #include "random.hpp"
 #include "utils.hpp"
@@ -39,6 +42,16 @@ double get_time() {
     return elapse / 1000;
 }
 
+U64 get_cycles() {
+    // Time stamp counter for timing short operations, nanoseconds where there is none.
+    #if defined(__GNUC__) && defined(__x86_64__)
+        return __rdtsc();
+    #else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    #endif
+}
+
 
 string strip(const string& str) {
     if (str == "") return str;
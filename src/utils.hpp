@@ -31,6 +31,7 @@ using std::vector;
 using std::string;
 
 double get_time();
+U64 get_cycles();
 
 string strip(const string&);
 string replace(string, const string&);